@@ -131,3 +131,40 @@ dobench "0 0 1 0" "search-all-preinserted"
 echo
 echo "Search All Empty"
 dobench "0 0 0 1" "search-all-empty"
+
+# $1 -> ratios
+# $2 -> test name
+dobatch() {
+	ratios="$1"
+	test_name="$2"
+
+	for b in 1 2 4 8 16 32 64; do
+		echo "batch size $b"
+		# no time limit (0), then the batch size
+		unit "./freeze" "$nodes" "$def_chain_size" "$def_hash_size" "$ratios 0 $b" "$test_name-batch-$b"
+	done
+}
+
+echo
+echo "Batched Searches"
+dobatch "0 0 1 0" "search-all-preinserted"
+
+# $1 -> ratios
+# $2 -> test name
+dochains() {
+	ratios="$1"
+	test_name="$2"
+
+	for c in 1 2 4 8 16; do
+		for l in 1 2; do
+			echo "chain size $c, layout $l"
+			# no time limit (0), single searches (1), no bulk load (0),
+			# fixed level widths, then the chain layout
+			unit "./freeze" "$nodes" "$c" "$def_hash_size" "$ratios 0 1 0 $def_hash_size $def_hash_size 0 0 0 0 0 $l" "$test_name-chain-$c-layout-$l"
+		done
+	done
+}
+
+echo
+echo "Spread And Packed Chains"
+dochains "0 0 1 0" "search-all-preinserted"
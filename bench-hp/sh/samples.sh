@@ -68,4 +68,5 @@ if grep 'Frozen' "$tmp" >/dev/null 2>&1; then
 	avg 'Max depth'
 	avg 'Paths Traversed'
 	avg 'Average path length'
+	avg 'Pool hit rate'
 fi
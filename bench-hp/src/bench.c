@@ -21,6 +21,47 @@ struct drand48_data **thread_seeds[SEED_GROUP_COUNT];
 long nproc;
 struct op_ratios operations;
 
+// searches are grouped into calls to lfht_search_batch()
+// of up to batch_size hashes
+int batch_size = 1;
+
+// stage 2 builds the map with lfht_bulk_load()
+int bulk_load = 0;
+
+// stage 3 ends by rebuilding the map from one thread, its keys
+// inserted in random order (1), spreading the leaves of a chain over
+// the pool, or in bucket order (2), so they sit next to each other as
+// in a chunk of several leaves per cache line
+int chain_layout = 0;
+
+struct search_batch {
+	size_t *hashes;
+	void **values;
+	int n;
+};
+
+void batch_search(struct search_batch *b, size_t value, int tid)
+{
+	if(batch_size <= 1) {
+		lfht_search(head, value, tid);
+		return;
+	}
+
+	b->hashes[b->n++] = value;
+	if(b->n == batch_size) {
+		lfht_search_batch(head, b->hashes, b->values, b->n, tid);
+		b->n = 0;
+	}
+}
+
+void batch_flush(struct search_batch *b, int tid)
+{
+	if(b->n > 0) {
+		lfht_search_batch(head, b->hashes, b->values, b->n, tid);
+		b->n = 0;
+	}
+}
+
 void *pt_preremove(void *entry_point)
 {
 	int tid = ((intptr_t)entry_point);
@@ -80,6 +121,91 @@ void *pt_preinsert(void *entry_point)
 	return NULL;
 }
 
+// same keys as pt_preinsert(), loaded by nproc threads at once
+void preinsert_bulk()
+{
+	size_t n = 0;
+	size_t *hashes = malloc(SEED_GROUP_COUNT * test_size * sizeof(size_t));
+	void **values = malloc(SEED_GROUP_COUNT * test_size * sizeof(void*));
+
+	for(int i = 0; i < SEED_GROUP_COUNT; i++) {
+		for(int tid = 0; tid < nproc; tid++) {
+			int nodes = test_size / nproc;
+			if (tid == nproc - 1 && test_size % nproc != 0) {
+				nodes += test_size % nproc;
+			}
+
+			struct drand48_data key_gen = *nproc_seeds[i][tid];
+			for(int j = 0; j < nodes; j++) {
+				size_t rng;
+				lrand48_r(&key_gen, (long int *) &rng);
+				hashes[n] = rng * GOLD_RATIO;
+				values[n] = (void*)hashes[n];
+				n++;
+			}
+		}
+	}
+
+	struct timespec load_start, load_end;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &load_start);
+	lfht_bulk_load(head, hashes, values, n, nproc);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &load_end);
+	printf("Bulk load time (s): %f\n",
+			(load_end.tv_sec - load_start.tv_sec) +
+			(load_end.tv_nsec - load_start.tv_nsec) / 1000000000.0);
+
+	free(hashes);
+	free(values);
+}
+
+// same keys as the map, at the same tree levels, in a fresh table
+void relayout_chains(
+		struct lfht_config *config,
+		int max_threads)
+{
+	size_t n = 0;
+	size_t cap = 1024;
+	size_t *hashes = malloc(cap * sizeof(size_t));
+
+	struct lfht_iter iter;
+	struct lfht_entry entry;
+	lfht_iter_begin(head, &iter, 0);
+	while(lfht_iter_next(&iter, &entry)) {
+		if(n == cap) {
+			cap *= 2;
+			hashes = realloc(hashes, cap * sizeof(size_t));
+		}
+		// in bit-reversed hash order, i.e. bucket by bucket
+		hashes[n++] = entry.hash;
+	}
+	lfht_iter_end(&iter);
+
+	if(chain_layout == 1) {
+		struct drand48_data shuffle;
+		srand48_r(0, &shuffle);
+		for(size_t i = n; i > 1; i--) {
+			long rng;
+			lrand48_r(&shuffle, &rng);
+			size_t j = rng % i;
+			size_t tmp = hashes[i - 1];
+			hashes[i - 1] = hashes[j];
+			hashes[j] = tmp;
+		}
+	}
+
+	free_lfht(head);
+	head = init_lfht_config(max_threads, config);
+	for(int i = 0; i < nproc; i++) {
+		lfht_init_thread(head, i);
+	}
+
+	for(size_t i = 0; i < n; i++) {
+		lfht_insert(head, hashes[i], (void*)hashes[i], 0);
+	}
+
+	free(hashes);
+}
+
 void *pt_seedrecord(void *entry_point)
 {
 	int gid = ((intptr_t)entry_point);
@@ -233,6 +359,11 @@ void *pt_bench(void *entry_point)
 	ratios.cs = 0;
 	ratios.cm = 0;
 
+	struct search_batch batch;
+	batch.hashes = malloc(batch_size * sizeof(size_t));
+	batch.values = malloc(batch_size * sizeof(void*));
+	batch.n = 0;
+
 	srand48_r(tid, &op_select);
 
 	for(int i = 0; i < nodes; i++) {
@@ -246,16 +377,14 @@ void *pt_bench(void *entry_point)
 						&terminate,
 						1,
 						memory_order_release);
-				lfht_end_thread(head, tid);
-				return NULL;
+				break;
 			}
 
 			// other threads check termination status
 			if(tid > 0 && atomic_load_explicit(
 						&terminate,
 						memory_order_relaxed) > 0) {
-				lfht_end_thread(head, tid);
-				return NULL;
+				break;
 			}
 		}
 
@@ -269,7 +398,7 @@ void *pt_bench(void *entry_point)
 
 			lrand48_r(&seed_s, (long int *) &rng);
 			value = rng * GOLD_RATIO;
-			lfht_search(head, value, tid);
+			batch_search(&batch, value, tid);
 			continue;
 		}
 
@@ -309,9 +438,13 @@ void *pt_bench(void *entry_point)
 
 		lrand48_r(&seed_m, (long int *) &rng);
 		value = rng * GOLD_RATIO;
-		lfht_search(head, value, tid);
+		batch_search(&batch, value, tid);
 	}
 
+	batch_flush(&batch, tid);
+	free(batch.hashes);
+	free(batch.values);
+
 	lfht_end_thread(head, tid);
 	return NULL;
 }
@@ -319,7 +452,7 @@ void *pt_bench(void *entry_point)
 int main(int argc, char **argv)
 {
 	if(argc < 8) {
-		printf("usage: %s <nodes> <threads> <chain length> <hash size> <inserts> <removes> <searches found> <searches not found> [<time>]\n", argv[0]);
+		printf("usage: %s <nodes> <threads> <chain length> <hash size> <inserts> <removes> <searches found> <searches not found> [<time>] [<batch size>] [<bulk load>] [<max hash size>] [<min hash size>] [<sorted chains>] [<directory bits>] [<compress delay>] [<merge levels>] [<max root hash size>] [<chain layout>]\n", argv[0]);
 		return 1;
 	}
 
@@ -328,6 +461,15 @@ int main(int argc, char **argv)
 	size_t max_chain_nodes = atoi(argv[3]);
 	size_t root_hash_size = atoi(argv[4]);
 	size_t hash_size = root_hash_size;
+	// levels are hash_size wide unless set
+	size_t max_hash_size = hash_size;
+	size_t min_hash_size = hash_size;
+	int sorted_chains = 0;
+	int dir_bits = 0;
+	int compress_delay = 0;
+	int merge_levels = 0;
+	// the root keeps its width unless set
+	int max_root_hash_size = 0;
 
 	// settings the ranges for op selection
 	// e.g. 50% inserts, 25% removes, 25% searches, 0% missmatches
@@ -342,12 +484,55 @@ int main(int argc, char **argv)
 		dtime = atof(argv[9]);
 	}
 
+	if (argc > 10) {
+		batch_size = atoi(argv[10]);
+	}
+
+	if (argc > 11) {
+		bulk_load = atoi(argv[11]);
+	}
+
+	if (argc > 12) {
+		max_hash_size = atoi(argv[12]);
+	}
+
+	if (argc > 13) {
+		min_hash_size = atoi(argv[13]);
+	}
+
+	if (argc > 14) {
+		sorted_chains = atoi(argv[14]);
+	}
+
+	if (argc > 15) {
+		dir_bits = atoi(argv[15]);
+	}
+
+	if (argc > 16) {
+		compress_delay = atoi(argv[16]);
+	}
+
+	if (argc > 17) {
+		merge_levels = atoi(argv[17]);
+	}
+
+	if (argc > 18) {
+		max_root_hash_size = atoi(argv[18]);
+	}
+
+	if (argc > 19) {
+		chain_layout = atoi(argv[19]);
+	}
+
 	nproc = sysconf(_SC_NPROCESSORS_ONLN);
 	int processors = nproc;
 
 	// prevent scheduling of threads of different NUMA nodes when
 	// using less n_threads than all cores of one node
 	int cores_per_node = nproc / NUMA_NODES;
+	if (cores_per_node < 1) {
+		cores_per_node = 1;
+	}
 	nproc = ((int)((n_threads-1) / cores_per_node) + 1) * cores_per_node;
 	if (nproc > processors) {
 		nproc = processors;
@@ -358,12 +543,22 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	threads = malloc(nproc*sizeof(pthread_t));
-	head = init_lfht_explicit(
-			nproc,
-			root_hash_size,
-			hash_size,
-			max_chain_nodes);
+	// the seed recorder takes a thread per group
+	threads = malloc((nproc > SEED_GROUP_COUNT ? nproc : SEED_GROUP_COUNT)*sizeof(pthread_t));
+	struct lfht_config config;
+	lfht_default_config(&config);
+	config.root_hash_size = root_hash_size;
+	config.max_root_hash_size = max_root_hash_size;
+	config.hash_size = hash_size;
+	config.max_hash_size = max_hash_size;
+	config.min_hash_size = min_hash_size;
+	config.max_chain_nodes = max_chain_nodes;
+	config.sorted_chains = sorted_chains;
+	config.dir_bits = dir_bits;
+	config.compress_delay = compress_delay;
+	config.merge_levels = merge_levels;
+	head = init_lfht_config(nproc, &config);
+	int max_threads = nproc;
 
 	for(int i = 0; i < nproc; i++) {
 		lfht_init_thread(head, i);
@@ -398,11 +593,15 @@ int main(int argc, char **argv)
 
 	// insertion of groups
 	printf("[Stage 2] Pre inserting...\n");
-	for(int i = 0; i < nproc; i++) {
-		pthread_create(&threads[i], NULL, pt_preinsert, (void*)(intptr_t)i);
-	}
-	for(int i = 0; i < nproc; i++) {
-		pthread_join(threads[i], NULL);
+	if (bulk_load) {
+		preinsert_bulk();
+	} else {
+		for(int i = 0; i < nproc; i++) {
+			pthread_create(&threads[i], NULL, pt_preinsert, (void*)(intptr_t)i);
+		}
+		for(int i = 0; i < nproc; i++) {
+			pthread_join(threads[i], NULL);
+		}
 	}
 
 	// removal of "insertion" and "searches not found" groups
@@ -413,8 +612,19 @@ int main(int argc, char **argv)
 	for(int i = 0; i < nproc; i++) {
 		pthread_join(threads[i], NULL);
 	}
+	if (chain_layout) {
+		relayout_chains(&config, max_threads);
+	}
 
 #if LFHT_STATS
+	if(head->dir) {
+		unsigned long dir_updates = 0;
+		for(int i = 0; i < nproc; i++) {
+			dir_updates += head->stats[i]->dir_updates;
+		}
+		printf("Directory updates while loading: %lu\n", dir_updates);
+	}
+
 	for(int i = 0; i < nproc; i++) {
 		lfht_reset_stats(head, i);
 	}
@@ -13,6 +13,8 @@
 #define GOLD_RATIO 11400714819323198485ULL
 #define LRAND_MAX (1ULL<<31)
 #define THROUGHPUT_TIME_PRECISION 100
+// one key in SPARSE_KEPT is left by pt_remove_sparse()
+#define SPARSE_KEPT 64
 
 // thread global variables
 struct op_ratios {
@@ -170,6 +172,10 @@ void print_stats() {
 	// statistics
 	int compression_counter = 0;
 	int compression_rollback_counter = 0;
+	int deferred_compression_counter = 0;
+	int avoided_compression_counter = 0;
+	int merge_counter = 0;
+	int root_growth_counter = 0;
 	int expansion_counter = 0;
 	int unfreeze_counter = 0;
 	int freeze_counter = 0;
@@ -183,14 +189,22 @@ void print_stats() {
 	int max_depth = 0;
 	unsigned long paths = 0;
 	unsigned long lookups = 0;
+	unsigned long pool_hits = 0;
+	unsigned long pool_misses = 0;
+	unsigned long pool_remote_frees = 0;
+	unsigned long dir_updates = 0;
 	int hashes = 0;
 
 	HpStats* stats = hp_gather_stats();
 
 	for(int i=0; i < n_threads; i++){
-		memory += head->stats[i]->memory_alloc - head->stats[i]->memory_free - stats->reclaimed;
+		memory += head->stats[i]->memory_alloc - head->stats[i]->memory_free;
 		compression_counter += head->stats[i]->compression_counter;
 		compression_rollback_counter += head->stats[i]->compression_rollback_counter;
+		deferred_compression_counter += head->stats[i]->deferred_compression_counter;
+		avoided_compression_counter += head->stats[i]->avoided_compression_counter;
+		merge_counter += head->stats[i]->merge_counter;
+		root_growth_counter += head->stats[i]->root_growth_counter;
 		expansion_counter += head->stats[i]->expansion_counter;
 		unfreeze_counter += head->stats[i]->unfreeze_counter;
 		freeze_counter += head->stats[i]->freeze_counter;
@@ -205,6 +219,10 @@ void print_stats() {
 		}
 		paths += head->stats[i]->paths;
 		lookups += head->stats[i]->lookups;
+		pool_hits += head->stats[i]->pool_hits;
+		pool_misses += head->stats[i]->pool_misses;
+		pool_remote_frees += head->stats[i]->pool_remote_frees;
+		dir_updates += head->stats[i]->dir_updates;
 
 		if(n_threads > 1) {
 			fprintf(stderr, "Thread %d Real Time (s): %lf\n", i, head->stats[i]->term.tv_sec - start_monoraw.tv_sec + (head->stats[i]->term.tv_nsec - start_monoraw.tv_nsec) / 1000000000.0);
@@ -224,7 +242,17 @@ void print_stats() {
 	fprintf(stderr, "Frozen: %d\n", freeze_counter);
 	fprintf(stderr, "Compressed: %d\n", compression_counter);
 	fprintf(stderr, "Compressions rolledback: %d\n", compression_rollback_counter);
+	if(head->compress_delay) {
+		fprintf(stderr, "Compressions deferred: %d\n", deferred_compression_counter);
+		fprintf(stderr, "Compressions avoided: %d\n", avoided_compression_counter);
+	}
 	fprintf(stderr, "Expanded: %d\n", expansion_counter);
+	if(head->merge_levels) {
+		fprintf(stderr, "Merged: %d\n", merge_counter);
+	}
+	if(head->max_root_hash_size > head->root_hash_size) {
+		fprintf(stderr, "Root grown: %d\n", root_growth_counter);
+	}
 
 	double fail_rate = operations > 0 && max_retry_counter > 0
 		? 1-((double)operations)/((double)max_retry_counter)
@@ -237,6 +265,12 @@ void print_stats() {
 
 	fprintf(stderr, "Lookups: %ld\n", lookups);
 	fprintf(stderr, "Average path length: %lf\n", lookups > 0 && paths > 0 ? (double)paths/(double)lookups : 0);
+	fprintf(stderr, "Pool hit rate: %lf\n", pool_hits + pool_misses > 0 ? (double)pool_hits/(double)(pool_hits + pool_misses) : 0);
+	fprintf(stderr, "Pool remote frees: %lu\n", pool_remote_frees);
+	if(head->dir) {
+		fprintf(stderr, "Directory size (bytes): %lu\n", (1UL << head->dir_bits) * sizeof(lfht_ref));
+		fprintf(stderr, "Directory updates: %lu\n", dir_updates);
+	}
 
 	if(n_threads <= 1) {
 		return;
@@ -329,6 +363,12 @@ size_t* shuffle(size_t from, size_t n, size_t maximum_value, struct drand48_data
 	return a;
 }
 
+// hashes at most 1000 distinct values to force collisions
+size_t weak_key_hash(const void *key, size_t len)
+{
+	return lfht_hash_bytes(key, len) % 1000;
+}
+
 int are_hashes_equal(struct lfht_node *h1, struct lfht_node *h2)
 {
 	if (h1->hash.size != h2->hash.size) {
@@ -341,8 +381,8 @@ int are_hashes_equal(struct lfht_node *h1, struct lfht_node *h2)
 			return 0;
 		}
 
-		struct lfht_node* b1 = valid_ptr(h1->hash.array[i]);
-		struct lfht_node* b2 = valid_ptr(h2->hash.array[i]);
+		struct lfht_node* b1 = valid_ptr(from_ref(h1->hash.array[i]));
+		struct lfht_node* b2 = valid_ptr(from_ref(h2->hash.array[i]));
 		if (b1->type != b2->type) {
 			fprintf(stderr, "Buckets differ in type B1:%d B2:%d\n", b1->type, b2->type);
 			return 0;
@@ -363,20 +403,20 @@ int are_hashes_equal(struct lfht_node *h1, struct lfht_node *h2)
 				struct lfht_node* chain2 = b2;
 				int found = 0;
 				while (chain2->type != HASH) {
-					if (chain2->type == LEAF && chain2->leaf.hash == nxt1->leaf.hash) {
+					if (chain2->type == LEAF && leaf_hash(chain2, 0) == leaf_hash(nxt1, 0)) {
 						found = 1;
 						break;
 					}
-					chain2 = valid_ptr(chain2->leaf.next);
+					chain2 = valid_ptr(get_next(chain2));
 				}
 				if (!found) {
-					fprintf(stderr, "Node <%016lX> of map 1 not found in sister chain of map 2 (Level %d, Bucket %d)).\n", nxt1->leaf.hash, h1->hash.hash_pos/h1->hash.size, i);
+					fprintf(stderr, "Node <%016lX> of map 1 not found in sister chain of map 2 (Level %d, Bucket %d)).\n", leaf_hash(nxt1, 0), h1->hash.hash_pos/h1->hash.size, i);
 					return 0;
 				}
 			}
 
-			nxt1 = valid_ptr(nxt1->leaf.next);
-			nxt2 = valid_ptr(nxt2->leaf.next);
+			nxt1 = valid_ptr(get_next(nxt1));
+			nxt2 = valid_ptr(get_next(nxt2));
 		}
 
 		if ((nxt1 == h1 && nxt2 != h2) || (nxt1 != h1 && nxt2 == h2)) {
@@ -412,17 +452,18 @@ start: ;
 	}
 
 	for(int i = 0; i < 1<<root->hash.size; i++) {
-		struct lfht_node* nxt = root->hash.array[i];
+		struct lfht_node* nxt = from_ref(root->hash.array[i]);
 
 		if (nxt == root) {
 			continue;
 		}
 
 		while (nxt->type != HASH) {
-			if (nxt->type == LEAF && !is_invalid(nxt->leaf.next)) {
+			if (nxt->type == LEAF && !is_invalid(get_next(nxt)) &&
+					!is_removed(nxt)) {
 				res++;
 			}
-			nxt = valid_ptr(nxt->leaf.next);
+			nxt = valid_ptr(get_next(nxt));
 		}
 
 		if (nxt == root) {
@@ -441,6 +482,179 @@ int map_size(struct lfht_head *head)
 	return hash_size(root);
 }
 
+// qsort() order of hashes
+int compare_keys(const void *k1, const void *k2)
+{
+	size_t h1 = *(const size_t *) k1;
+	size_t h2 = *(const size_t *) k2;
+	return (h1 > h2) - (h1 < h2);
+}
+
+// number of hash levels on the deepest path below hnode
+int hash_depth(struct lfht_node *hnode)
+{
+	int res = 0;
+
+	for(int i = 0; i < 1<<hnode->hash.size; i++) {
+		struct lfht_node* nxt = from_ref(hnode->hash.array[i]);
+
+		while (nxt->type != HASH) {
+			nxt = valid_ptr(get_next(nxt));
+		}
+
+		if (nxt != hnode) {
+			int depth = hash_depth(nxt);
+			res = depth > res ? depth : res;
+		}
+	}
+
+	return res + 1;
+}
+
+int map_depth(struct lfht_head *head)
+{
+	return hash_depth(head->entry_hash);
+}
+
+int longest_chain(struct lfht_node *hnode)
+{
+	int res = 0;
+
+	for(int i = 0; i < 1<<hnode->hash.size; i++) {
+		struct lfht_node* nxt = from_ref(hnode->hash.array[i]);
+		int count = 0;
+
+		while (nxt->type != HASH) {
+			count++;
+			nxt = valid_ptr(get_next(nxt));
+		}
+
+		if (nxt != hnode) {
+			int longest = longest_chain(nxt);
+			count = longest > count ? longest : count;
+		}
+		res = count > res ? count : res;
+	}
+
+	return res;
+}
+
+// checks the occupied counts of the levels, exact once no thread
+// is inserting or removing
+// leaves that cross a cache line, each costs a second miss
+int split_leaves(struct lfht_node *hnode)
+{
+	int res = 0;
+	size_t size = pool_class_size(LEAF_CLASS);
+
+	for(int i = 0; i < 1<<hnode->hash.size; i++) {
+		struct lfht_node* nxt = from_ref(hnode->hash.array[i]);
+
+		while (nxt->type != HASH) {
+			if ((uintptr_t) nxt % CACHE_SIZE + size > CACHE_SIZE) {
+				res++;
+			}
+			nxt = valid_ptr(get_next(nxt));
+		}
+
+		if (nxt != hnode) {
+			res += split_leaves(nxt);
+		}
+	}
+
+	return res;
+}
+
+int are_counts_exact(struct lfht_node *hnode)
+{
+	int occupied = 0;
+
+	for(int i = 0; i < 1<<hnode->hash.size; i++) {
+		struct lfht_node* nxt = from_ref(hnode->hash.array[i]);
+
+		if (nxt != hnode) {
+			occupied++;
+		}
+
+		while (nxt->type != HASH) {
+			nxt = valid_ptr(get_next(nxt));
+		}
+
+		if (nxt != hnode && !are_counts_exact(nxt)) {
+			return 0;
+		}
+	}
+
+	if (atomic_load(&(hnode->hash.occupied)) != occupied) {
+		fprintf(stderr, "Level at %d counts %d buckets instead of %d.\n", hnode->hash.hash_pos, atomic_load(&(hnode->hash.occupied)), occupied);
+		return 0;
+	}
+	return 1;
+}
+
+// checks the order of the chains of tables with sorted_chains,
+// increasing hashes or decreasing on reversed levels
+int are_chains_sorted(struct lfht_node *hnode)
+{
+	for(int i = 0; i < 1<<hnode->hash.size; i++) {
+		struct lfht_node* nxt = from_ref(hnode->hash.array[i]);
+		struct lfht_node* last = NULL;
+
+		while (nxt->type != HASH) {
+			if (!is_invalid(get_next(nxt))) {
+				// hashes of a chain share their implied bits
+				if (last && (hnode->hash.reversed ?
+							leaf_hash(last, 0) < leaf_hash(nxt, 0) :
+							leaf_hash(last, 0) > leaf_hash(nxt, 0))) {
+					return 0;
+				}
+				last = nxt;
+			}
+			nxt = valid_ptr(get_next(nxt));
+		}
+
+		if (nxt != hnode && !are_chains_sorted(nxt)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// bytes of the nodes below hnode, as carved out of the pools
+size_t hash_memory(struct lfht_head *head, struct lfht_node *hnode)
+{
+	size_t res = pool_class_size(HASH_CLASS + hnode->hash.size);
+
+	for(int i = 0; i < 1<<hnode->hash.size; i++) {
+		struct lfht_node* nxt = from_ref(hnode->hash.array[i]);
+
+		while (nxt->type != HASH) {
+			res += pool_class_size(head->key_eq ? KEY_LEAF_CLASS : LEAF_CLASS);
+			nxt = valid_ptr(get_next(nxt));
+		}
+
+		if (nxt != hnode) {
+			res += hash_memory(head, nxt);
+		}
+	}
+
+	return res;
+}
+
+size_t map_memory(struct lfht_head *head)
+{
+	size_t res = 0;
+
+	// roots the current one grew from
+	for(struct lfht_node *root = head->base_hash; root != head->entry_hash;
+			root = from_ref(root->hash.array[0])) {
+		res += pool_class_size(HASH_CLASS + root->hash.size);
+	}
+
+	return res + hash_memory(head, head->entry_hash);
+}
+
 int examine_hash_state(struct lfht_node *hnode, int flags)
 {
 	int res = 0;
@@ -459,7 +673,7 @@ start: ;
 	}
 
 	for(int i = 0; i < 1<<root->hash.size; i++) {
-		struct lfht_node* nxt = valid_ptr(root->hash.array[i]);
+		struct lfht_node* nxt = valid_ptr(from_ref(root->hash.array[i]));
 
 		if (!nxt) {
 			res |= null_node;
@@ -475,13 +689,13 @@ start: ;
 				res |= freeze_nodes_flag;
 			} else if (nxt->type == UNFREEZE) {
 				res |= unfreeze_nodes_flag;
-			} else if (is_invalid(nxt->leaf.next)) {
+			} else if (is_invalid(get_next(nxt))) {
 				res |= invalid_nodes_flag;
 			} else {
 				res |= valid_nodes_flag;
 			}
 
-			nxt = valid_ptr(nxt->leaf.next);
+			nxt = valid_ptr(get_next(nxt));
 			if (!nxt) {
 				break;
 			}
@@ -496,7 +710,10 @@ start: ;
 			continue;
 		}
 
-		if (nxt->hash.hash_pos <= root->hash.hash_pos) {
+		// levels below are one size deeper, or the single bucket
+		// level of a merge
+		if (nxt->hash.hash_pos != root->hash.hash_pos + root->hash.size &&
+				!is_merge_target(root, nxt)) {
 			res |= cycles_flag;
 			continue;
 		}
@@ -600,7 +817,7 @@ int is_expanded(struct lfht_head *head)
 {
 	struct lfht_node* root = head->entry_hash;
 	for(int i = 0; i < 1<<root->hash.size; i++) {
-		struct lfht_node* nxt = root->hash.array[i];
+		struct lfht_node* nxt = from_ref(root->hash.array[i]);
 		if (nxt != root && nxt->type == HASH) {
 			return 1;
 		}
@@ -750,6 +967,138 @@ void *pt_contiguous_add_remove(void *entry_point)
 	return NULL;
 }
 
+// values carry the key in their low half and the writer in the high half
+void *pt_put_remove(void *entry_point)
+{
+	int tid = ((intptr_t)entry_point);
+	struct drand48_data *s = seed[tid];
+
+	for(int i = 0; i < test_size; i++){
+		size_t rng;
+		lrand48_r(s, (long int *) &rng);
+
+		size_t k = 1 + rng % contention;
+		size_t v = ((size_t)tid << 32) | k;
+		size_t old;
+		switch(rng / contention % 3) {
+		case 0:
+			old = (size_t)lfht_put(head, k, (void*)v, tid);
+			break;
+		case 1:
+			lfht_remove(head, k, tid);
+			old = 0;
+			break;
+		default:
+			old = (size_t)lfht_search(head, k, tid);
+		}
+
+		if(old && (old & 0xffffffff) != k) {
+			printf("Failed\nKey %lu mapped to value %016lX.\n", k, old);
+			exit(1);
+		}
+	}
+
+	for(size_t k = 1; k <= (size_t)contention; k++){
+		lfht_remove(head, k, tid);
+	}
+
+	lfht_end_thread(head, tid);
+	return NULL;
+}
+
+void *pt_fetch_add(void *entry_point)
+{
+	int tid = ((intptr_t)entry_point);
+	struct drand48_data *s = seed[tid];
+
+	for(int i = 0; i < test_size; i++){
+		size_t rng;
+		lrand48_r(s, (long int *) &rng);
+		lfht_fetch_add(head, rng % contention, 1, tid);
+	}
+
+	lfht_end_thread(head, tid);
+	return NULL;
+}
+
+// ctx points to the threshold below which counters are dropped
+void *decrement_or_drop(void *value, void *ctx)
+{
+	if((size_t)value <= *(size_t *)ctx) {
+		return NULL;
+	}
+	return (void *)((size_t)value - 1);
+}
+
+// removes its share of even keys while batch searching all of them
+void *pt_batch_remove(void *entry_point)
+{
+	int tid = ((intptr_t)entry_point);
+	size_t hashes[64];
+	void *values[64];
+
+	for(size_t k = 2*tid; k < (size_t)test_size; k += 2*n_threads){
+		lfht_remove(head, k, tid);
+	}
+
+	for(size_t k = 0; k < (size_t)test_size; k += 64){
+		int n = 0;
+		for(; n < 64 && k + n < (size_t)test_size; n++) {
+			hashes[n] = k + n;
+		}
+
+		lfht_search_batch(head, hashes, values, n, tid);
+		for(int i = 0; i < n; i++) {
+			size_t v = (size_t)values[i];
+			if(v != hashes[i] && (v || hashes[i] % 2)) {
+				printf("Failed\nKey %lu has value %lu.\n", hashes[i], v);
+				exit(1);
+			}
+		}
+	}
+
+	lfht_end_thread(head, tid);
+	return NULL;
+}
+
+// inserts and removes keys past test_size
+void *pt_churn(void *entry_point)
+{
+	int tid = ((intptr_t)entry_point);
+	struct drand48_data *s = seed[tid];
+
+	for(int i = 0; i < test_size; i++){
+		size_t rng;
+		lrand48_r(s, (long int *) &rng);
+
+		size_t k = test_size + rng % contention;
+		if(rng / contention % 2) {
+			lfht_insert(head, k, (void*)k, tid);
+		} else {
+			lfht_remove(head, k, tid);
+		}
+	}
+
+	lfht_end_thread(head, tid);
+	return NULL;
+}
+
+struct prefix_count {
+	size_t mask;
+	size_t prefix;
+	int count;
+};
+
+void count_prefix(struct lfht_entry *entry, void *ctx)
+{
+	struct prefix_count *c = ctx;
+	if((entry->hash & c->mask) != c->prefix) {
+		printf("Failed\nKey %016lX is out of prefix %lX.\n", entry->hash, c->prefix);
+		exit(1);
+	}
+	c->count++;
+}
+
 void *pt_random_load(void *entry_point)
 {
 	int tid = ((intptr_t)entry_point);
@@ -1008,6 +1357,34 @@ void *pt_remove_all(void *entry_point) {
 	return NULL;
 }
 
+// removes the keys of the thread while searching the keys 1 to
+// HOT_KEYS, which must stay in the map, as the levels around them
+// are compressed
+#define HOT_KEYS 64
+void *pt_remove_search_hot(void *entry_point) {
+	int tid = ((intptr_t)entry_point);
+	struct drand48_data *s = seed[tid];
+
+	int nodes = test_size/n_threads;
+	for(int i = 0; i < nodes; i++){
+		size_t rng;
+		size_t value;
+		lrand48_r(s, (long int *) &rng);
+		value = rng * GOLD_RATIO;
+
+		lfht_remove(head, value, tid);
+
+		size_t hot = 1 + i % HOT_KEYS;
+		if((size_t)lfht_search(head, hot, tid) != hot) {
+			printf("Failed\nKey %lX was not found.\n", hot);
+			exit(1);
+		}
+	}
+
+	lfht_end_thread(head, tid);
+	return NULL;
+}
+
 void *pt_insert_all(void *entry_point) {
 	int tid = ((intptr_t)entry_point);
 	struct drand48_data *s = seed[tid];
@@ -1064,6 +1441,99 @@ void *pt_load_seq(void *entry_point)
 	return NULL;
 }
 
+// i-th of distinct keys spread over the trie, every SPARSE_KEPT-th
+// one too, unlike multiples of GOLD_RATIO
+size_t spread_key(size_t i)
+{
+	size_t key = (i + 1) * GOLD_RATIO;
+	key ^= key >> 31;
+	key *= 0xff51afd7ed558ccdUL;
+	return key ^ (key >> 29);
+}
+
+void *pt_load_spread(void *entry_point)
+{
+	int tid = ((intptr_t)entry_point);
+	size_t nodes = (size_t)(test_size / n_threads);
+
+	for(size_t i = nodes*tid; i < nodes*tid + nodes; i++) {
+		lfht_insert(head, spread_key(i), (void*)spread_key(i), tid);
+	}
+
+	return NULL;
+}
+
+// removes the keys of pt_load_spread() but one in SPARSE_KEPT
+void *pt_remove_sparse(void *entry_point)
+{
+	int tid = ((intptr_t)entry_point);
+	size_t nodes = (size_t)(test_size / n_threads);
+
+	for(size_t i = nodes*tid; i < nodes*tid + nodes; i++) {
+		if(i % SPARSE_KEPT) {
+			lfht_remove(head, spread_key(i), tid);
+		}
+	}
+
+	return NULL;
+}
+
+// lean tables of test 32, keys go round robin over them
+struct lfht_head **lean_heads;
+int n_lean;
+
+// loads the keys of pt_load_spread() over the lean tables, then
+// removes every other key of each table
+void *pt_lean(void *entry_point)
+{
+	int tid = ((intptr_t)entry_point);
+	size_t nodes = (size_t)(test_size / n_threads);
+
+	for(size_t i = nodes*tid; i < nodes*tid + nodes; i++) {
+		struct lfht_head *lean = lean_heads[i % n_lean];
+		lfht_insert(lean, spread_key(i), (void*)spread_key(i), tid);
+	}
+
+	for(size_t i = nodes*tid; i < nodes*tid + nodes; i++) {
+		struct lfht_head *lean = lean_heads[i % n_lean];
+		if((i / n_lean) % 2) {
+			lfht_remove(lean, spread_key(i), tid);
+		} else if(lfht_search(lean, spread_key(i), tid) != (void*)spread_key(i)) {
+			printf("Failed\nKey %lX was not found.\n", spread_key(i));
+			exit(1);
+		}
+	}
+
+	return NULL;
+}
+
+// second table of test 33, used along with head
+struct lfht_head *other;
+
+// loads the keys of pt_load_spread() into head and other, then
+// removes them from other once they are found in both
+void *pt_two_tables(void *entry_point)
+{
+	int tid = ((intptr_t)entry_point);
+	size_t nodes = (size_t)(test_size / n_threads);
+
+	for(size_t i = nodes*tid; i < nodes*tid + nodes; i++) {
+		lfht_insert(head, spread_key(i), (void*)spread_key(i), tid);
+		lfht_insert(other, spread_key(i), (void*)spread_key(i), tid);
+	}
+
+	for(size_t i = nodes*tid; i < nodes*tid + nodes; i++) {
+		if(lfht_search(head, spread_key(i), tid) != (void*)spread_key(i) ||
+				lfht_search(other, spread_key(i), tid) != (void*)spread_key(i)) {
+			printf("Failed\nKey %lX was not found in both tables.\n", spread_key(i));
+			exit(1);
+		}
+		lfht_remove(other, spread_key(i), tid);
+	}
+
+	return NULL;
+}
+
 #if LFHT_DEBUG
 void dump_graph_handler() {
 	if(!head) {
@@ -22,7 +22,7 @@ void print_compression_node(struct lfht_node *lnode, FILE *file){
 			(uintptr_t)lnode,
 			(uintptr_t)lnode,
 			lnode->type == FREEZE ? f : u);
-	fprintf(file, "\t%lu:out -> %lu:in\n", (uintptr_t)lnode, (uintptr_t)valid_ptr(lnode->leaf.next));
+	fprintf(file, "\t%lu:out -> %lu:in\n", (uintptr_t)lnode, (uintptr_t)valid_ptr(get_next(lnode)));
 }
 
 void print_hnode(struct lfht_node *hnode, struct lfht_node *parent, FILE *file){
@@ -36,8 +36,8 @@ void print_hnode(struct lfht_node *hnode, struct lfht_node *parent, FILE *file){
 			//hnode->hash.counter);
 			0);
 	for(size_t i = 0; i < (size_t)(1 << hnode->hash.size); i++) {
-		_Atomic(struct lfht_node *) *b = &(hnode->hash.array[i]);
-		struct lfht_node *curr = valid_ptr(atomic_load_explicit(b, memory_order_consume));
+		_Atomic(lfht_ref) *b = &(hnode->hash.array[i]);
+		struct lfht_node *curr = valid_ptr(ref_load(b, memory_order_consume));
 
 		if(hnode == curr) {
 			continue;
@@ -46,16 +46,16 @@ void print_hnode(struct lfht_node *hnode, struct lfht_node *parent, FILE *file){
 		fprintf(file, "|<%zu>%zu", i, i);
 	}
 	fprintf(file, "\"]\n");
-	if(hnode->hash.BP)
-		fprintf(file, "\t%lu:BP -> %lu:in\n", (uintptr_t)hnode, (uintptr_t)hnode->hash.BP);
-	if(parent && hnode->hash.BP != parent) {
-		print_hnode(hnode->hash.BP, parent, file);
+	if(from_ref(hnode->hash.BP))
+		fprintf(file, "\t%lu:BP -> %lu:in\n", (uintptr_t)hnode, (uintptr_t)from_ref(hnode->hash.BP));
+	if(parent && from_ref(hnode->hash.BP) != parent) {
+		print_hnode(from_ref(hnode->hash.BP), parent, file);
 	}
 
 	struct lfht_node *comp = NULL;
 	for(size_t i = 0; i < (size_t)(1 << hnode->hash.size); i++){
-		_Atomic(struct lfht_node *) *b = &(hnode->hash.array[i]);
-		struct lfht_node *curr = atomic_load_explicit(b, memory_order_consume);
+		_Atomic(lfht_ref) *b = &(hnode->hash.array[i]);
+		struct lfht_node *curr = ref_load(b, memory_order_consume);
 		unsigned invalid = is_invalid(curr);
 		curr = valid_ptr(curr);
 
@@ -90,13 +90,13 @@ void print_lnode(struct lfht_node *lnode, struct lfht_node *parent, FILE *file){
 			"\t%lu [label=\"%lu|{<out>%d}|%lu\"]\n",
 			(uintptr_t)lnode,
 			(uintptr_t)lnode,
-			is_invalid(lnode->leaf.next),
-			lnode->leaf.hash);
-	fprintf(file, "\t%lu:out -> %lu:in [color=%s]\n", (uintptr_t)lnode, (uintptr_t)valid_ptr(lnode->leaf.next), color(is_invalid(lnode->leaf.next)));
-	if(valid_ptr(lnode->leaf.next)->type == LEAF)
-		print_lnode(valid_ptr(lnode->leaf.next), parent, file);
-	if(valid_ptr(lnode->leaf.next)->type == HASH && parent != valid_ptr(lnode->leaf.next))
-		print_hnode(valid_ptr(lnode->leaf.next), parent, file);
+			is_invalid(get_next(lnode)),
+			leaf_hash(lnode, 0));
+	fprintf(file, "\t%lu:out -> %lu:in [color=%s]\n", (uintptr_t)lnode, (uintptr_t)valid_ptr(get_next(lnode)), color(is_invalid(get_next(lnode))));
+	if(valid_ptr(get_next(lnode))->type == LEAF)
+		print_lnode(valid_ptr(get_next(lnode)), parent, file);
+	if(valid_ptr(get_next(lnode))->type == HASH && parent != valid_ptr(get_next(lnode)))
+		print_hnode(valid_ptr(get_next(lnode)), parent, file);
 }
 
 void print_node(struct lfht_node *node, struct lfht_node *parent, FILE *file){
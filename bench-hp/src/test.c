@@ -3,7 +3,7 @@
 int main(int argc, char **argv)
 {
 	if(argc < 3) {
-		printf("usage: %s <test number (1-23)> <cores>\n", argv[0]);
+		printf("usage: %s <test number (1-36)> <cores>\n", argv[0]);
 		return 1;
 	}
 
@@ -67,6 +67,22 @@ int main(int argc, char **argv)
 			printf("Failed\nTried to add nodes to map but map is empty.\n");
 			exit(1);
 		}
+#if LFHT_STATS
+		// the stats count every node but the root
+		size_t counted = head->stats[0]->memory_alloc - head->stats[0]->memory_free +
+			pool_class_size(HASH_CLASS + head->entry_hash->hash.size);
+		if (counted != map_memory(head)) {
+			printf("Failed\nStats count %lu bytes of nodes instead of %lu.\n", counted, map_memory(head));
+			exit(1);
+		}
+#endif
+#if !LFHT_COMPACT_LEAVES
+		// only compact leaves are packed across cache lines
+		if (split_leaves(head->entry_hash)) {
+			printf("Failed\n%d leaves cross a cache line.\n", split_leaves(head->entry_hash));
+			exit(1);
+		}
+#endif
 
 		assert_map_state(head, all_flags & ~valid_nodes_flag & ~expanded_flag);
 		break;
@@ -489,6 +505,1506 @@ int main(int argc, char **argv)
 		assert_map_state(head, all_flags);
 		break;
 
+	case 13:
+		printf("%d. Single threaded, string keys with colliding hashes... ", select);
+		n_threads = 1;
+		test_size = 20000;
+
+		struct lfht_config config;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+		config.key_hash = weak_key_hash;
+		config.key_eq = lfht_eq_bytes;
+		head = init_lfht_config(n_threads, &config);
+
+		char (*names)[16] = malloc(test_size * sizeof(*names));
+		for(int i = 0; i < test_size; i++) {
+			snprintf(names[i], sizeof(names[i]), "key-%d", i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i = 0; i < test_size; i++) {
+			lfht_insert_key(head, names[i], strlen(names[i]), (void*)(intptr_t)(i+1), 0);
+		}
+
+		// every key keeps its own value despite sharing hashes
+		for(int i = 0; i < test_size; i++) {
+			intptr_t v = (intptr_t)lfht_search_key(head, names[i], strlen(names[i]), 0);
+			if(v != i+1) {
+				printf("Failed\nKey %s has value %ld instead of %d.\n", names[i], v, i+1);
+				exit(1);
+			}
+		}
+
+		for(int i = 0; i < test_size; i += 2) {
+			lfht_remove_key(head, names[i], strlen(names[i]), 0);
+		}
+
+		for(int i = 0; i < test_size; i++) {
+			intptr_t v = (intptr_t)lfht_search_key(head, names[i], strlen(names[i]), 0);
+			intptr_t expected = i % 2 ? i+1 : 0;
+			if(v != expected) {
+				printf("Failed\nKey %s has value %ld instead of %ld.\n", names[i], v, expected);
+				exit(1);
+			}
+		}
+
+		for(int i = 1; i < test_size; i += 2) {
+			lfht_remove_key(head, names[i], strlen(names[i]), 0);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		free(names);
+		break;
+
+	case 14:
+		printf("%d. Multi threaded, replace values in place and check put results... ", select);
+
+		test_size = 1000000;
+		contention = 1000;
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		// put and insert_if_absent return the value they found
+		for(size_t k = 1; k <= (size_t)contention; k++){
+			if(lfht_insert_if_absent(head, k, (void*)k, 0) ||
+					lfht_insert_if_absent(head, k, (void*)(k+1), 0) != (void*)k ||
+					lfht_put(head, k, (void*)(k+2), 0) != (void*)k ||
+					lfht_search(head, k, 0) != (void*)(k+2)) {
+				printf("Failed\nUnexpected value replacing key %lu.\n", k);
+				exit(1);
+			}
+			lfht_remove(head, k, 0);
+			if(lfht_put(head, k, (void*)k, 0)) {
+				printf("Failed\nRemoved key %lu still has a value.\n", k);
+				exit(1);
+			}
+		}
+
+		if(map_size(head) != contention) {
+			printf("Failed\nExpected %d nodes but found %d.\n", contention, map_size(head));
+			exit(1);
+		}
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_put_remove, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 15:
+		printf("%d. Multi threaded, concurrent counters with fetch_add and compute... ", select);
+
+		test_size = 1000000;
+		contention = 1000;
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_fetch_add, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		// no increment was lost
+		lfht_init_thread(head, 0);
+		size_t sum = 0;
+		for(size_t k = 0; k < (size_t)contention; k++){
+			sum += (size_t)lfht_search(head, k, 0);
+		}
+		if(sum != (size_t)test_size * n_threads) {
+			printf("Failed\nCounters add up to %lu instead of %lu.\n", sum, (size_t)test_size * n_threads);
+			exit(1);
+		}
+
+		// compute counts every counter down and drops it
+		size_t threshold = 1;
+		for(size_t k = 0; k < (size_t)contention; k++){
+			size_t v = (size_t)lfht_search(head, k, 0);
+			while(v--) {
+				if((size_t)lfht_compute(head, k, decrement_or_drop, &threshold, 0) != v) {
+					printf("Failed\nKey %lu was not counted down to %lu.\n", k, v);
+					exit(1);
+				}
+			}
+		}
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 16:
+		printf("%d. Multi threaded, batched searches during removals... ", select);
+
+		test_size = 1<<20;
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		for(size_t k = 1; k < (size_t)test_size; k++){
+			lfht_insert(head, k, (void*)k, 0);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			pthread_create(&threads[i], NULL, pt_batch_remove, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		// batches of every size agree with lfht_search()
+		lfht_init_thread(head, 0);
+		size_t *hashes = malloc(test_size * sizeof(size_t));
+		void **values = malloc(test_size * sizeof(void*));
+		for(size_t k = 0; k < (size_t)test_size; k++){
+			hashes[k] = k;
+		}
+
+		for(int n = 1; n <= 4*BATCH_SLOTS + 1; n++) {
+			for(int k = 0; k + n <= test_size; k += n * 97) {
+				lfht_search_batch(head, hashes + k, values + k, n, 0);
+				for(int i = k; i < k + n; i++) {
+					if(values[i] != lfht_search(head, hashes[i], 0)) {
+						printf("Failed\nBatch of %d found %p for key %lu.\n", n, values[i], hashes[i]);
+						exit(1);
+					}
+				}
+			}
+		}
+
+		free(hashes);
+		free(values);
+		break;
+
+	case 17:
+		printf("%d. Multi threaded, iterate while other keys are added and removed... ", select);
+
+		test_size = 1<<20;
+		contention = 100000;
+		head = init_lfht_explicit(
+				n_threads + 1,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i <= n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		for(size_t k = 0; k < (size_t)test_size; k++){
+			lfht_insert(head, k, (void*)k, n_threads);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_churn, (void*)(intptr_t)i);
+		}
+
+		// untouched keys are returned exactly once, churned ones at most once
+		char *seen = malloc(test_size + contention);
+		for(int j = 0; j < 3; j++) {
+			memset(seen, 0, test_size + contention);
+
+			struct lfht_iter iter;
+			struct lfht_entry entry;
+			lfht_iter_begin(head, &iter, n_threads);
+			while(lfht_iter_next(&iter, &entry)) {
+				if(entry.hash >= (size_t)(test_size + contention) ||
+						(size_t)entry.value != entry.hash ||
+						seen[entry.hash]++) {
+					printf("Failed\nUnexpected entry <%lu, %p>.\n", entry.hash, entry.value);
+					exit(1);
+				}
+			}
+			lfht_iter_end(&iter);
+
+			for(int k = 0; k < test_size; k++) {
+				if(!seen[k]) {
+					printf("Failed\nKey %d was not returned.\n", k);
+					exit(1);
+				}
+			}
+		}
+		free(seen);
+
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+		break;
+
+	case 18:
+		printf("%d. Single threaded, scan hash prefixes of random keys... ", select);
+		n_threads = 1;
+		test_size = 200000;
+
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+		srand48_r(0, seed[0]);
+
+		size_t *random_keys = malloc(test_size * sizeof(size_t));
+		for(int i = 0; i < test_size; i++) {
+			size_t rng;
+			lrand48_r(seed[0], (long int *) &rng);
+			random_keys[i] = rng * GOLD_RATIO;
+			if(lfht_insert_if_absent(head, random_keys[i], (void*)random_keys[i], 0)) {
+				// duplicate key
+				i--;
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		int prefix_bits[] = {0, 1, 3, root_hash_size, root_hash_size + 5, 40, 64};
+		for(unsigned b = 0; b < sizeof(prefix_bits)/sizeof(int); b++) {
+			for(int j = 0; j < 20; j++) {
+				struct prefix_count c;
+				c.mask = prefix_bits[b] < 64 ? ((size_t)1 << prefix_bits[b]) - 1 : (size_t)-1;
+				c.prefix = random_keys[j * 1000] & c.mask;
+				c.count = 0;
+				lfht_scan_prefix(head, c.prefix, prefix_bits[b], count_prefix, &c, 0);
+
+				int expected = 0;
+				for(int i = 0; i < test_size; i++) {
+					expected += (random_keys[i] & c.mask) == c.prefix;
+				}
+				if(c.count != expected) {
+					printf("Failed\nPrefix %lX of %d bits has %d keys instead of %d.\n", c.prefix, prefix_bits[b], c.count, expected);
+					exit(1);
+				}
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+		free(random_keys);
+		break;
+
+	case 19:
+		printf("%d. Multi threaded, compare size counters and estimates with the map size... ", select);
+
+		test_size = 1<<20;
+		contention = 100000;
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		srand48_r(0, seed[0]);
+		load_map(head, test_size, 0, seed[0]);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_churn, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		size_t nodes = map_size(head);
+		if(lfht_size_approx(head) != nodes) {
+			printf("Failed\nCounted %lu nodes but the map has %lu.\n", lfht_size_approx(head), nodes);
+			exit(1);
+		}
+
+		lfht_init_thread(head, 0);
+		size_t estimate = lfht_size_sampled(head, 4096, 0);
+		if(estimate < nodes * 0.9 || estimate > nodes * 1.1) {
+			printf("Failed\nEstimated %lu nodes but the map has %lu.\n", estimate, nodes);
+			exit(1);
+		}
+		break;
+
+	case 20:
+		printf("%d. Multi threaded, bulk load a partially filled map and search every key... ", select);
+
+		test_size = 1<<20;
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+		srand48_r(0, seed[0]);
+
+		// every 8th key is repeated and every 256th is already mapped
+		size_t *bulk_keys = malloc(test_size * sizeof(size_t));
+		void **bulk_values = malloc(test_size * sizeof(void *));
+		for(int i = 0; i < test_size; i++) {
+			size_t rng;
+			lrand48_r(seed[0], (long int *) &rng);
+			bulk_keys[i] = i % 8 == 7 ? bulk_keys[i - 3] : rng * GOLD_RATIO;
+			bulk_values[i] = (void *) bulk_keys[i];
+			if(i % 256 == 0) {
+				lfht_insert_if_absent(head, bulk_keys[i], (void *) bulk_keys[i], 0);
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		lfht_bulk_load(head, bulk_keys, bulk_values, test_size, n_threads);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		for(int i = 0; i < test_size; i++) {
+			if(lfht_search(head, bulk_keys[i], 0) != (void *) bulk_keys[i]) {
+				printf("Failed\nKey %lX was not loaded.\n", bulk_keys[i]);
+				exit(1);
+			}
+		}
+
+		// count the distinct keys
+		qsort(bulk_keys, test_size, sizeof(size_t), compare_keys);
+		size_t loaded = 0;
+		for(int i = 0; i < test_size; i++) {
+			loaded += i == 0 || bulk_keys[i] != bulk_keys[i - 1];
+		}
+
+		if(map_size(head) != (int) loaded || lfht_size_approx(head) != loaded) {
+			printf("Failed\nLoaded %lu keys but the map has %d and counted %lu.\n", loaded, map_size(head), lfht_size_approx(head));
+			exit(1);
+		}
+		assert_map_state(head, all_flags & ~valid_nodes_flag & ~expanded_flag);
+		free(bulk_keys);
+		free(bulk_values);
+		break;
+
+	case 21:
+		printf("%d. Single threaded, compare levels of fixed and adaptive widths on skewed keys... ", select);
+		n_threads = 1;
+		test_size = 1<<16;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+
+		// the bits above the root share the same 12 bits
+		size_t *skewed_keys = malloc(test_size * sizeof(size_t));
+		srand48_r(0, seed[0]);
+		for(int i = 0; i < test_size; i++) {
+			size_t rng;
+			lrand48_r(seed[0], (long int *) &rng);
+			skewed_keys[i] = (rng * GOLD_RATIO) << (root_hash_size + 12) |
+				(rng & ((1 << root_hash_size) - 1));
+		}
+
+		// levels of fixed widths
+		config.max_hash_size = hash_size;
+		head = init_lfht_config(1, &config);
+		lfht_init_thread(head, 0);
+		for(int i = 0; i < test_size; i++) {
+			lfht_insert(head, skewed_keys[i], (void *) skewed_keys[i], 0);
+		}
+		int fixed_size = map_size(head);
+		int fixed_depth = map_depth(head);
+		free_lfht(head);
+
+		config.max_hash_size = MAX_HASH_SIZE;
+		head = init_lfht_config(1, &config);
+		lfht_init_thread(head, 0);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i = 0; i < test_size; i++) {
+			lfht_insert(head, skewed_keys[i], (void *) skewed_keys[i], 0);
+		}
+		for(int i = 0; i < test_size; i++) {
+			if(lfht_search(head, skewed_keys[i], 0) != (void *) skewed_keys[i]) {
+				printf("Failed\nKey %lX was not found.\n", skewed_keys[i]);
+				exit(1);
+			}
+		}
+
+		if(map_size(head) != fixed_size) {
+			printf("Failed\nMap has %d nodes instead of %d.\n", map_size(head), fixed_size);
+			exit(1);
+		}
+		if(map_depth(head) >= fixed_depth) {
+			printf("Failed\nMap has %d levels against %d of fixed widths.\n", map_depth(head), fixed_depth);
+			exit(1);
+		}
+
+		for(int i = 0; i < test_size; i++) {
+			lfht_remove(head, skewed_keys[i], 0);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		free(skewed_keys);
+		break;
+
+	case 22:
+		printf("%d. Single threaded, compare memory of narrow and fixed width levels... ", select);
+		n_threads = 1;
+		test_size = 1<<18;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+
+		// levels of fixed widths
+		head = init_lfht_config(1, &config);
+		lfht_init_thread(head, 0);
+		srand48_r(0, seed[0]);
+		load_map(head, test_size, 0, seed[0]);
+		size_t fixed_memory = map_memory(head);
+		free_lfht(head);
+
+		config.min_hash_size = 1;
+		head = init_lfht_config(1, &config);
+		lfht_init_thread(head, 0);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		srand48_r(0, seed[0]);
+		load_map(head, test_size, 0, seed[0]);
+		srand48_r(0, seed[0]);
+		if(!are_all_keys_inserted(head, test_size, seed[0])) {
+			printf("Failed\nNot all nodes were inserted.\n");
+			exit(1);
+		}
+		if(map_memory(head) >= fixed_memory) {
+			printf("Failed\nMap takes %lu bytes against %lu of fixed widths.\n", map_memory(head), fixed_memory);
+			exit(1);
+		}
+
+		srand48_r(0, seed[0]);
+		remove_all(head, seed[0], test_size, 0);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 23:
+		printf("%d. Multi threaded, add/remove/lookup on sorted chains and check their order... ", select);
+		test_size = 1<<20;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = 8;
+		config.sorted_chains = 1;
+		head = init_lfht_config(n_threads, &config);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_load_map, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		if(!are_chains_sorted(head->entry_hash)) {
+			printf("Failed\nChains are out of order after loading.\n");
+			exit(1);
+		}
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			if(!are_all_keys_inserted(head, test_size/n_threads, seed[i])) {
+				printf("Failed\nNot all nodes were inserted.\n");
+				exit(1);
+			}
+		}
+
+		// inserts and removes racing with expansions and early
+		// terminated lookups
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_random, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		if(!are_chains_sorted(head->entry_hash)) {
+			printf("Failed\nChains are out of order after random operations.\n");
+			exit(1);
+		}
+		lfht_init_thread(head, 0);
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			remove_all(head, seed[i], test_size/n_threads, 0);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 24:
+		printf("%d. Multi threaded, search hot keys while the levels below them are compressed... ", select);
+		test_size = 1<<20;
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		load_all_map(head, seed);
+		for(size_t k = 1; k <= HOT_KEYS; k++) {
+			lfht_insert(head, k, (void*)k, 0);
+		}
+
+		// lookups of the hot keys start from the jump caches
+		for(int i=0; i < n_threads; i++){
+			pthread_create(&threads[i], NULL, pt_remove_search_hot, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		if(map_size(head) != HOT_KEYS) {
+			printf("Failed\nMap has %d nodes instead of %d.\n", map_size(head), HOT_KEYS);
+			exit(1);
+		}
+
+		lfht_init_thread(head, 0);
+		for(size_t k = 1; k <= HOT_KEYS; k++) {
+			lfht_remove(head, k, 0);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 25:
+		printf("%d. Multi threaded, add and remove keys through a directory and check its entries... ", select);
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+		config.dir_bits = root_hash_size + 2 * hash_size;
+		head = init_lfht_config(n_threads, &config);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_load_map, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			if(!are_all_keys_inserted(head, test_size/n_threads, seed[i])) {
+				printf("Failed\nNot all nodes were inserted.\n");
+				exit(1);
+			}
+		}
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_remove_all, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+
+		// every level was compressed
+		for(size_t i = 0; i < (size_t) 1 << head->dir_bits; i++) {
+			if(from_ref(head->dir[i]) != head->entry_hash) {
+				printf("Failed\nDirectory entry %lu still points below the root.\n", i);
+				exit(1);
+			}
+		}
+		break;
+
+	case 26:
+		printf("%d. Multi threaded, add/remove/lookup and check the counts of occupied buckets... ", select);
+		test_size = 1<<20;
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_load_map, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		// removals that leave buckets empty race with inserts
+		// that fill them
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_random, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		if(!are_counts_exact(head->entry_hash)) {
+			printf("Failed\nCounts of occupied buckets are off.\n");
+			exit(1);
+		}
+
+		lfht_init_thread(head, 0);
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			remove_all(head, seed[i], test_size/n_threads, 0);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		// as in test 11, levels emptied while others were inserting
+		// may stay expanded, their counts must still be exact
+		assert_map_state(head, all_flags & ~expanded_flag);
+		if(!are_counts_exact(head->entry_hash)) {
+			printf("Failed\nCounts of occupied buckets are off once empty.\n");
+			exit(1);
+		}
+		break;
+
+	case 27:
+		printf("%d. Single threaded, add and remove keys around an expansion with a compression delay... ", select);
+		n_threads = 1;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+		config.compress_delay = 16;
+		head = init_lfht_config(1, &config);
+		lfht_init_thread(head, 0);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		// one key more than a chain holds, all in root bucket 1
+		int rounds = 100;
+		for(int r = 0; r < rounds; r++) {
+			for(size_t k = 1; k <= max_chain_nodes + 1; k++) {
+				lfht_insert(head, k << head->root_hash_size | 1, (void *) k, 0);
+			}
+			for(size_t k = 1; k <= max_chain_nodes + 1; k++) {
+				lfht_remove(head, k << head->root_hash_size | 1, 0);
+			}
+		}
+
+		if(map_depth(head) != 2) {
+			printf("Failed\nThe empty level was not kept.\n");
+			exit(1);
+		}
+#if LFHT_STATS
+		if(head->stats[0]->expansion_counter != 1 ||
+				head->stats[0]->avoided_compression_counter != rounds - 1) {
+			printf("Failed\nExpected 1 expansion and %d avoided compressions, got %d and %d.\n",
+					rounds - 1,
+					head->stats[0]->expansion_counter,
+					head->stats[0]->avoided_compression_counter);
+			exit(1);
+		}
+#endif
+
+		// misses on the empty level end its idle age
+		for(size_t k = 1; k <= 16; k++) {
+			if(lfht_search(head, (max_chain_nodes + 1 + k) << head->root_hash_size | 1, 0)) {
+				printf("Failed\nFound a key that was never inserted.\n");
+				exit(1);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 28:
+		printf("%d. Single threaded, compare memory left by removals with and without merging sparse levels... ", select);
+		n_threads = 1;
+		test_size = 1<<18;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+
+		// levels kept while they hold a key
+		head = init_lfht_config(1, &config);
+		lfht_init_thread(head, 0);
+		pt_load_spread((void *) 0);
+		pt_remove_sparse((void *) 0);
+		size_t unmerged_memory = map_memory(head);
+		int unmerged_depth = map_depth(head);
+		free_lfht(head);
+
+		config.merge_levels = 1;
+		head = init_lfht_config(1, &config);
+		lfht_init_thread(head, 0);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		pt_load_spread((void *) 0);
+		pt_remove_sparse((void *) 0);
+		for(int i = 0; i < test_size; i++) {
+			void *value = lfht_search(head, spread_key(i), 0);
+			if(value != (i % SPARSE_KEPT ? NULL : (void *) spread_key(i))) {
+				printf("Failed\nKey %lX was %s.\n", spread_key(i),
+						value ? "not removed" : "not found");
+				exit(1);
+			}
+		}
+
+		if(map_size(head) != test_size / SPARSE_KEPT) {
+			printf("Failed\nMap has %d nodes instead of %d.\n", map_size(head), test_size / SPARSE_KEPT);
+			exit(1);
+		}
+		if(map_memory(head) >= unmerged_memory || map_depth(head) > unmerged_depth) {
+			printf("Failed\nMap takes %lu bytes and %d levels against %lu and %d unmerged.\n",
+					map_memory(head),
+					map_depth(head),
+					unmerged_memory,
+					unmerged_depth);
+			exit(1);
+		}
+
+		for(int i = 0; i < test_size; i += SPARSE_KEPT) {
+			lfht_remove(head, spread_key(i), 0);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 29:
+		printf("%d. Multi threaded, add/remove/lookup while sparse levels are merged... ", select);
+		test_size = 1<<20;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+		config.merge_levels = 1;
+		head = init_lfht_config(n_threads, &config);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			pthread_create(&threads[i], NULL, pt_load_spread, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		// levels are merged while others still remove from them
+		for(int i=0; i < n_threads; i++){
+			pthread_create(&threads[i], NULL, pt_remove_sparse, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		for(int i = 0; i < test_size; i += SPARSE_KEPT) {
+			if(lfht_search(head, spread_key(i), 0) != (void *) spread_key(i)) {
+				printf("Failed\nKey %lX was not found.\n", spread_key(i));
+				exit(1);
+			}
+		}
+		if(map_size(head) != test_size / SPARSE_KEPT) {
+			printf("Failed\nMap has %d nodes instead of %d.\n", map_size(head), test_size / SPARSE_KEPT);
+			exit(1);
+		}
+
+		// and while inserts expand them again
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_random, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		lfht_init_thread(head, 0);
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			remove_all(head, seed[i], test_size/n_threads, 0);
+		}
+		for(int i = 0; i < test_size; i += SPARSE_KEPT) {
+			lfht_remove(head, spread_key(i), 0);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		// as in test 26
+		assert_map_state(head, all_flags & ~expanded_flag);
+		if(!are_counts_exact(head->entry_hash)) {
+			printf("Failed\nCounts of occupied buckets are off once empty.\n");
+			exit(1);
+		}
+		break;
+
+	case 30:
+		printf("%d. Single threaded, replay races of expansions and compressions one step at a time... ", select);
+		n_threads = 1;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+		head = init_lfht_config(1, &config);
+		lfht_init_thread(head, 0);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		// a single bucket level below the root, left out of the map
+		// so that nothing but the replayed step touches it
+		struct lfht_node *replay_level =
+			create_hash_node(head, 0, 0, root_hash_size, head->entry_hash);
+		struct lfht_node *replay_leaf =
+			create_leaf_node(head, 0, 1, NULL, (void *) 1, replay_level);
+		ref_init(&(replay_level->hash.array[0]), replay_leaf);
+		struct lfht_node *replay_new;
+
+		// expand() links a level after the leaf once a removal marked it
+		ref_store(&(replay_leaf->leaf.next), invalid_ptr(replay_level), memory_order_seq_cst);
+		if(expand(head, 0, &replay_new, replay_level, hash_size, 1, &(replay_leaf->leaf.next)) ||
+				ref_load(&(replay_level->hash.array[0]), memory_order_seq_cst) != replay_leaf ||
+				get_next(replay_leaf) != invalid_ptr(replay_level)) {
+			printf("Failed\nA level was linked after a marked leaf.\n");
+			exit(1);
+		}
+
+		// a lagging help_expansion() finds the chain of the bucket
+		// linked to another level since, as a merge does
+		struct lfht_node *replay_other =
+			create_hash_node(head, 0, 0, root_hash_size, replay_level);
+		replay_new = create_hash_node(head, 0, 0, root_hash_size, replay_level);
+		ref_store(&(replay_leaf->leaf.next), replay_other, memory_order_seq_cst);
+		if(help_expansion(head, 0, replay_level, replay_new, 1) ||
+				ref_load(&(replay_level->hash.array[0]), memory_order_seq_cst) != replay_leaf) {
+			printf("Failed\nA bucket was pointed to a level its chain does not end at.\n");
+			exit(1);
+		}
+
+		// a lookup finds a compression node that left the bucket
+		// since, the level behind it may be retired already
+		struct lfht_node *replay_freeze =
+			create_freeze_node(head, 0, replay_new);
+		if(protect_behind(head, 0, &(replay_level->hash.array[0]), replay_freeze)) {
+			printf("Failed\nThe level behind a stale compression node was used.\n");
+			exit(1);
+		}
+
+		node_free(head, 0, replay_freeze);
+		node_free(head, 0, replay_new);
+		node_free(head, 0, replay_other);
+		node_free(head, 0, replay_leaf);
+		node_free(head, 0, replay_level);
+
+		// a helper froze a bucket after the compression was aborted,
+		// lookups reset it instead of going to the parent forever
+		replay_level = create_hash_node(head, 0, 0, root_hash_size, head->entry_hash);
+		replay_freeze = create_freeze_node(head, 0, replay_level);
+		atomic_store(&(replay_freeze->leaf.value), ABORTED);
+		ref_store(&(replay_level->hash.array[0]), replay_freeze, memory_order_seq_cst);
+		struct lfht_node *replay_hnode = replay_level;
+		struct lfht_node *replay_lnode;
+		lookup(head, 0, 1, NULL, &replay_hnode, &replay_lnode, NULL);
+		if(ref_load(&(replay_level->hash.array[0]), memory_order_seq_cst) != replay_level) {
+			printf("Failed\nA bucket frozen by an aborted compression was kept.\n");
+			exit(1);
+		}
+		node_free(head, 0, replay_freeze);
+		node_free(head, 0, replay_level);
+
+#if LFHT_FILTERS
+		// a lookup that loaded the filter before as many insertions
+		// as the version counts may not clear the bit they set
+		replay_level = create_hash_node(head, 0, 0, root_hash_size, head->entry_hash);
+		filter_begin(1, replay_level, filter_bit(1, replay_level));
+		filter_end(1, replay_level);
+		uint64_t replay_filter = atomic_load(get_filter(1, replay_level));
+		for(int i = 0; i < 1<<16; i++) {
+			filter_begin(1, replay_level, filter_bit(1, replay_level));
+			filter_end(1, replay_level);
+		}
+		filter_update(1, replay_level, replay_filter, 0);
+		if(!(atomic_load(get_filter(1, replay_level)) & filter_bit(1, replay_level))) {
+			printf("Failed\nA stale lookup cleared the filter bit of a new leaf.\n");
+			exit(1);
+		}
+		node_free(head, 0, replay_level);
+#endif
+
+		// a removed leaf left behind by a move is the last one of
+		// the chain of the root and the first one of the new level,
+		// lookups retire it from the latter only
+		replay_new = create_hash_node(head, 0, hash_size, root_hash_size, head->entry_hash);
+		replay_leaf = create_leaf_node(head, 0, 1, NULL, REMOVED, replay_new);
+		ref_store(&(replay_leaf->leaf.next), invalid_ptr(replay_new), memory_order_seq_cst);
+		ref_store(get_atomic_bucket(1, replay_new), replay_leaf, memory_order_seq_cst);
+		ref_store(get_atomic_bucket(1, head->entry_hash), replay_leaf, memory_order_seq_cst);
+		count_bucket(replay_new, 1);
+		count_bucket(head->entry_hash, 1);
+#if LFHT_FILTERS
+		atomic_fetch_or(get_filter(1, replay_new), filter_bit(1, replay_new));
+		atomic_fetch_or(get_filter(1, head->entry_hash), filter_bit(1, head->entry_hash));
+#endif
+		lfht_search(head, 1, 0);
+		lfht_search(head, 1, 0);
+		int retired = 0;
+		for(HpRetired *r = head->hazard_pointers[0]->rlist; r; r = r->next) {
+			retired += r->pointer == replay_leaf;
+		}
+		if(retired != 1) {
+			printf("Failed\nA moved leaf was retired %d times.\n", retired);
+			exit(1);
+		}
+
+		// the map itself is left as it was
+		lfht_insert(head, 1, (void *) 1, 0);
+		lfht_remove(head, 1, 0);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 31:
+		printf("%d. Multi threaded, load map while the root grows and check all inserted nodes... ", select);
+		test_size = 1<<20;
+		lfht_default_config(&config);
+		config.root_hash_size = root_hash_size;
+		// past the bits compact leaves take from the root
+		config.max_root_hash_size = 18;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+		config.dir_bits = config.max_root_hash_size;
+		head = init_lfht_config(n_threads, &config);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_load_map, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			if(!are_all_keys_inserted(head, test_size/n_threads, seed[i])) {
+				printf("Failed\nNot all nodes were inserted.\n");
+				exit(1);
+			}
+		}
+		if(head->entry_hash->hash.size != config.max_root_hash_size) {
+			printf("Failed\nRoot is %d bits wide instead of %d.\n",
+					head->entry_hash->hash.size,
+					config.max_root_hash_size);
+			exit(1);
+		}
+		if(!are_counts_exact(head->entry_hash)) {
+			printf("Failed\nCounts of occupied buckets are off.\n");
+			exit(1);
+		}
+
+		for(int i=0; i < n_threads; i++){
+			srand48_r(i, seed[i]);
+			pthread_create(&threads[i], NULL, pt_remove_all, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+
+		// as in test 25, the entries left at the old roots moved on
+		for(size_t i = 0; i < (size_t) 1 << head->dir_bits; i++) {
+			if(from_ref(head->dir[i]) != head->entry_hash) {
+				printf("Failed\nDirectory entry %lu does not point to the root.\n", i);
+				exit(1);
+			}
+		}
+		break;
+
+	case 32:
+		printf("%d. Multi threaded, add/remove/lookup over many lean tables and check their footprint... ", select);
+		test_size = 1<<20;
+		n_lean = 1<<12;
+		lfht_default_config(&config);
+		config.root_hash_size = 2;
+		config.max_root_hash_size = 8;
+		config.hash_size = hash_size;
+		config.max_hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+		config.merge_levels = 1;
+		config.lean = 1;
+		lean_heads = malloc(n_lean * sizeof(struct lfht_head *));
+		lean_heads[0] = init_lfht_config(n_threads, &config);
+
+		// the first lean table sets up what every other one shares
+		int domains = hp_count_domains();
+		for(int i = 1; i < n_lean; i++) {
+			lean_heads[i] = init_lfht_config(n_threads, &config);
+		}
+		if(hp_count_domains() != domains) {
+			printf("Failed\nLean tables made %d domains instead of sharing one.\n",
+					hp_count_domains() - domains);
+			exit(1);
+		}
+		if(init_lfht_config(n_threads + 1, &config)) {
+			printf("Failed\nA lean table took more threads than it shares.\n");
+			exit(1);
+		}
+#if !LFHT_COMPACT_LEAVES
+		// compact leaves take 16 bits from the root
+		size_t footprint = sizeof(struct lfht_head) + map_memory(lean_heads[1]) +
+			n_threads * sizeof(*lean_heads[1]->lean_sizes);
+		if(footprint >= 1024) {
+			printf("Failed\nAn empty lean table takes %lu bytes.\n", footprint);
+			exit(1);
+		}
+#endif
+
+		// once for every lean table
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(lean_heads[0], i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			pthread_create(&threads[i], NULL, pt_lean, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		for(int i = 0; i < n_lean; i++) {
+			// threads count on their own, not on a shared counter
+			for(int j = 0; j < n_threads; j++) {
+				for(int l = 0; l < j; l++) {
+					if(lean_heads[i]->lean_sizes[j] == lean_heads[i]->lean_sizes[l]) {
+						printf("Failed\nThreads %d and %d of lean table %d count on one counter.\n", l, j, i);
+						exit(1);
+					}
+				}
+			}
+			size_t kept = test_size / n_lean / 2;
+			if(map_size(lean_heads[i]) != (int) kept || lfht_size_approx(lean_heads[i]) != kept) {
+				printf("Failed\nLean table %d has %d nodes and counted %lu instead of %lu.\n",
+						i, map_size(lean_heads[i]), lfht_size_approx(lean_heads[i]), kept);
+				exit(1);
+			}
+		}
+
+		// freeing some tables leaves the others be
+		for(int i = 1; i < n_lean; i += 2) {
+			free_lfht(lean_heads[i]);
+		}
+		for(int i = 0; i < test_size; i++) {
+			struct lfht_head *lean = lean_heads[i % n_lean];
+			void *expect = (i / n_lean) % 2 ? NULL : (void*)spread_key(i);
+			if(i % n_lean % 2 == 0 && lfht_search(lean, spread_key(i), 0) != expect) {
+				printf("Failed\nKey %lX is off after other tables were freed.\n", spread_key(i));
+				exit(1);
+			}
+		}
+		for(int i = 2; i < n_lean; i += 2) {
+			free_lfht(lean_heads[i]);
+		}
+		head = lean_heads[0];
+		free(lean_heads);
+		break;
+
+	case 33:
+		printf("%d. Multi threaded, add/remove/lookup on two tables and free one while the other goes on... ", select);
+		test_size = 1<<20;
+		int before = hp_count_domains();
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+		other = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+		if(hp_count_domains() != before + 2) {
+			printf("Failed\nTwo tables made %d domains.\n", hp_count_domains() - before);
+			exit(1);
+		}
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+			lfht_init_thread(other, i);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		for(int i=0; i < n_threads; i++){
+			pthread_create(&threads[i], NULL, pt_two_tables, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+
+		if(map_size(other) != 0) {
+			printf("Failed\nSecond table is not empty.\n");
+			exit(1);
+		}
+
+		// only the domain of other goes, head still reclaims through its own
+		free_lfht(other);
+		if(hp_count_domains() != before + 1) {
+			printf("Failed\nFreeing a table left %d domains.\n", hp_count_domains() - before);
+			exit(1);
+		}
+
+		for(int i=0; i < n_threads; i++){
+			pthread_create(&threads[i], NULL, pt_remove_sparse, (void*)(intptr_t)i);
+		}
+		for(int i=0; i < n_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		for(int i = 0; i < test_size; i += SPARSE_KEPT) {
+			if(lfht_search(head, spread_key(i), 0) != (void *) spread_key(i)) {
+				printf("Failed\nKey %lX was not found.\n", spread_key(i));
+				exit(1);
+			}
+		}
+		if(map_size(head) != test_size / SPARSE_KEPT) {
+			printf("Failed\nMap has %d nodes instead of %d.\n", map_size(head), test_size / SPARSE_KEPT);
+			exit(1);
+		}
+#if LFHT_REFS
+		// tables made and freed over and over take no new handles
+		// once the first one gave its slabs back
+		unsigned int slab_ids = 0;
+		for(int round = 0; round < 4; round++) {
+			struct lfht_head *churn = init_lfht_explicit(1, root_hash_size, hash_size, max_chain_nodes);
+			lfht_init_thread(churn, 0);
+			for(int i = 0; i < 1<<16; i++) {
+				lfht_insert(churn, spread_key(i), (void *) spread_key(i), 0);
+			}
+			free_lfht(churn);
+			if(round > 0 && ref_slab_count != slab_ids) {
+				printf("Failed\nFreed tables left %u slab ids in use.\n", ref_slab_count - slab_ids);
+				exit(1);
+			}
+			slab_ids = ref_slab_count;
+		}
+#endif
+		break;
+
+	case 34:
+		printf("%d. Multi threaded, bulk load keys repeated more often than a chain holds... ", select);
+
+		test_size = 1<<20;
+		head = init_lfht_explicit(
+				n_threads,
+				root_hash_size,
+				hash_size,
+				max_chain_nodes);
+
+		for(int i=0; i < n_threads; i++){
+			lfht_init_thread(head, i);
+		}
+
+		// each of 1<<16 keys is repeated 8 times, a last one fills
+		// the rest, values tell the copies apart
+		size_t *repeated_keys = malloc(test_size * sizeof(size_t));
+		void **repeated_values = malloc(test_size * sizeof(void *));
+		for(int i = 0; i < test_size; i++) {
+			repeated_keys[i] = i < 1<<19 ? (i % (1<<16)) * GOLD_RATIO : ~(size_t) 0;
+			repeated_values[i] = (void *) (intptr_t) (i + 1);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		lfht_bulk_load(head, repeated_keys, repeated_values, test_size, n_threads);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		// the first value of each key wins
+		for(int i = 0; i < 1<<16; i++) {
+			if(lfht_search(head, repeated_keys[i], 0) != repeated_values[i]) {
+				printf("Failed\nKey %lX was not loaded with its first value.\n", repeated_keys[i]);
+				exit(1);
+			}
+		}
+		if(lfht_search(head, ~(size_t) 0, 0) != repeated_values[1<<19]) {
+			printf("Failed\nKey %lX was not loaded with its first value.\n", ~(size_t) 0);
+			exit(1);
+		}
+		if(map_size(head) != (1<<16) + 1 || lfht_size_approx(head) != (1<<16) + 1) {
+			printf("Failed\nMap has %d nodes and counted %lu instead of %d.\n", map_size(head), lfht_size_approx(head), (1<<16) + 1);
+			exit(1);
+		}
+		if(map_depth(head) > 4) {
+			printf("Failed\nMap is %d levels deep.\n", map_depth(head));
+			exit(1);
+		}
+		assert_map_state(head, all_flags & ~valid_nodes_flag & ~expanded_flag);
+		free(repeated_keys);
+		free(repeated_values);
+		break;
+
+	case 35:
+		printf("%d. Single threaded, add keys that share the bits a growing root could take... ", select);
+		test_size = 1<<12;
+		n_threads = 1;
+		lfht_default_config(&config);
+		config.root_hash_size = 2;
+		config.max_root_hash_size = 8;
+		config.hash_size = hash_size;
+		config.max_chain_nodes = max_chain_nodes;
+		head = init_lfht_config(n_threads, &config);
+		lfht_init_thread(head, 0);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		// growing would leave them all in one bucket
+		for(int i = 0; i < test_size; i++) {
+			size_t v = ((size_t) i << 8) | 5;
+			lfht_insert(head, v, (void*)v, 0);
+		}
+
+		if(longest_chain(head->entry_hash) > (int) max_chain_nodes) {
+			printf("Failed\nA chain holds %d nodes.\n", longest_chain(head->entry_hash));
+			exit(1);
+		}
+		// compact leaves widen the first root past max_root_hash_size
+		if(head->entry_hash->hash.size != head->root_hash_size ||
+				head->max_root_hash_size != head->root_hash_size) {
+			printf("Failed\nRoot is %d bits wide and may grow to %d.\n",
+					head->entry_hash->hash.size,
+					head->max_root_hash_size);
+			exit(1);
+		}
+		for(int i = 0; i < test_size; i++) {
+			size_t v = ((size_t) i << 8) | 5;
+			if(lfht_search(head, v, 0) != (void*)v) {
+				printf("Failed\nKey %lX was not found.\n", v);
+				exit(1);
+			}
+		}
+
+		for(int i = 0; i < test_size; i++) {
+			size_t v = ((size_t) i << 8) | 5;
+			lfht_remove(head, v, 0);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+
+		assert_map_state(head, all_flags);
+		break;
+
+	case 36:
+		printf("%d. Single threaded, add, iterate and remove keys below a root of 0 bits... ", select);
+		test_size = 1<<16;
+		n_threads = 1;
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_process);
+
+		// the levels below such a root start at bit 0 too, once with
+		// a fixed root and once with one that grows
+		for(int grows = 0; grows < 2; grows++) {
+			lfht_default_config(&config);
+			config.root_hash_size = 0;
+			config.max_root_hash_size = grows ? 8 : 0;
+			config.hash_size = hash_size;
+			config.max_chain_nodes = max_chain_nodes;
+			head = init_lfht_config(n_threads, &config);
+			lfht_init_thread(head, 0);
+
+			for(int i = 0; i < test_size; i++) {
+				lfht_insert(head, spread_key(i), (void *) spread_key(i), 0);
+			}
+			if(longest_chain(head->entry_hash) > (int) max_chain_nodes) {
+				printf("Failed\nA chain holds %d nodes.\n", longest_chain(head->entry_hash));
+				exit(1);
+			}
+#if !LFHT_COMPACT_LEAVES
+			// compact leaves widen the root to 16 bits
+			struct lfht_node *level = from_ref(head->entry_hash->hash.array[0]);
+			while(level->type != HASH) {
+				level = valid_ptr(get_next(level));
+			}
+			if(level == head->entry_hash || is_root(level)) {
+				printf("Failed\nThe level below the root is %s.\n",
+						level == head->entry_hash ? "missing" : "taken for a root");
+				exit(1);
+			}
+#endif
+
+			struct lfht_iter iter;
+			struct lfht_entry entry;
+			int entries = 0;
+			lfht_iter_begin(head, &iter, 0);
+			while(lfht_iter_next(&iter, &entry)) {
+				if((size_t) entry.value != entry.hash ||
+						lfht_search(head, entry.hash, 0) != entry.value) {
+					printf("Failed\nUnexpected entry <%lu, %p>.\n", entry.hash, entry.value);
+					exit(1);
+				}
+				entries++;
+			}
+			lfht_iter_end(&iter);
+			if(entries != test_size) {
+				printf("Failed\nIterated over %d entries instead of %d.\n", entries, test_size);
+				exit(1);
+			}
+
+			for(int i = 0; i < test_size; i++) {
+				lfht_remove(head, spread_key(i), 0);
+			}
+			assert_map_state(head, all_flags);
+			if(!grows) {
+				free_lfht(head);
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end_monoraw);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_process);
+		break;
+
 	default:
 		fprintf(stderr, "No such test %d\n", select);
 		return 1;
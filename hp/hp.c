@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <hp.h>
 
 #define CACHE_SIZE 64
@@ -9,6 +10,7 @@
 static void scan(HpDomain* d, HpRecord* hp);
 static void help_scan(HpDomain* d, int tid);
 static HpRecord* acquire_rec(HpDomain* d, int tid);
+static void free_domain(HpDomain* d);
 
 // sorting
 static int qs_partition(void** arr, int left, int right);
@@ -17,7 +19,10 @@ static void quick_sort(void** arr, int len);
 static int binary_search(void** arr, int len, void* target);
 
 // global domain list
+// domains come and go with their tables, the list is only changed
+// and walked under domains_lock
 _Atomic(HpDomain*) domains;
+static pthread_mutex_t domains_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Domains separate lists of hazard pointers (HP) to prevent 
 // long scans
@@ -27,10 +32,12 @@ HpDomain* hp_create(int k, int h) {
 	atomic_init(&(new->next), NULL);
 	new->k = k; // HPs per record
 	new->h = h; // total ammount of HPs
+	new->reclaim = NULL;
+	new->reclaim_arg = NULL;
 
-	// try to append new domain
+	// append new domain
+	pthread_mutex_lock(&domains_lock);
 	_Atomic(HpDomain*)* target = &domains;
-start: ;
 	HpDomain* observed = atomic_load(target);
 
 	while(observed) {
@@ -40,16 +47,17 @@ start: ;
 	}
 	// observed == NULL => tail found
 
-	if(!atomic_compare_exchange_weak(target, &observed, new)) {
-		// someone else added a new domain
-		// advance list and retry
-		target = &(observed->next);
-		goto start;
-	}
+	atomic_store(target, new);
+	pthread_mutex_unlock(&domains_lock);
 
 	return new;
 }
 
+void hp_set_reclaim(HpDomain* d, void (*reclaim)(void* arg, int tid, void* p), void* arg) {
+	d->reclaim = reclaim;
+	d->reclaim_arg = arg;
+}
+
 // THREAD UNSAFE!
 // must be run by main thread at the end of the program
 // free all domains
@@ -58,36 +66,65 @@ void hp_destroy() {
 	hp_clear_stats();
 #endif
 
+	pthread_mutex_lock(&domains_lock);
 	HpDomain* head = atomic_load(&domains);
 
 	// clear shared pointer to the domain list
 	atomic_store(&domains, NULL);
+	pthread_mutex_unlock(&domains_lock);
 
 	// free each domain
 	while(head) {
 		HpDomain* del = head;
 		head = atomic_load(&(head->next));
+		free_domain(del);
+	}
+}
 
-		// clear all HP protections
-		HpRecord* rec = atomic_load(&(del->records));
-		while(rec) {
-			hp_clear(del, rec);
-			rec = atomic_load(&(rec->next));
-		}
+// no other thread may use d, other domains may be created or
+// destroyed meanwhile
+// free a single domain, the others are left as they are
+void hp_destroy_domain(HpDomain* d) {
+	pthread_mutex_lock(&domains_lock);
+	_Atomic(HpDomain*)* target = &domains;
+	HpDomain* observed = atomic_load(target);
 
-		help_scan(del, 0);
+	while(observed && observed != d) {
+		// advance domain list
+		target = &(observed->next);
+		observed = atomic_load(target);
+	}
 
-		// free all records from domain
-		rec = atomic_load(&(del->records));
-		while(rec) {
-			HpRecord* prev = rec;
-			rec = atomic_load(&(rec->next));
-			free(prev);
-		}
+	if(observed) {
+		// unlink domain
+		atomic_store(target, atomic_load(&(d->next)));
+	}
+	pthread_mutex_unlock(&domains_lock);
+
+	free_domain(d);
+}
 
-		// free domain
-		free(del);
+// reclaims whatever is left and frees d with its records
+static void free_domain(HpDomain* d) {
+	// clear all HP protections
+	HpRecord* rec = atomic_load(&(d->records));
+	while(rec) {
+		hp_clear(d, rec);
+		rec = atomic_load(&(rec->next));
 	}
+
+	help_scan(d, 0);
+
+	// free all records from domain
+	rec = atomic_load(&(d->records));
+	while(rec) {
+		HpRecord* prev = rec;
+		rec = atomic_load(&(rec->next));
+		free(prev);
+	}
+
+	// free domain
+	free(d);
 }
 
 // get a new hazard pointer
@@ -111,7 +148,11 @@ HpRecord* hp_alloc(HpDomain* d, int tid) {
 	new->rcount = 0;
 	new->index = 0;
 #if HP_STATS
-	new->stats.api_calls++;
+	new->stats.api_calls = 1;
+	new->stats.reclaimed = 0;
+	new->stats.retired = 0;
+	new->stats.guarded = 0;
+	new->stats.cleared = 0;
 #endif
 
 	// set hazard pointers array
@@ -377,10 +418,14 @@ static void scan(HpDomain* d, HpRecord* hp) {
 		}
 
 #if HP_STATS
-		//hp->stats.reclaimed += sizeof(*rlist->pointer);
+		hp->stats.reclaimed++;
 #endif
 		// we may now reclaim memory
-		free(rlist->pointer);
+		if(d->reclaim) {
+			d->reclaim(d->reclaim_arg, atomic_load(&(hp->active)), rlist->pointer);
+		} else {
+			free(rlist->pointer);
+		}
 		free(rlist);
 
 		if(!prev) {
@@ -495,6 +540,7 @@ static int binary_search(void** arr, int len, void* target) {
 
 #if HP_STATS
 int hp_count_domains() {
+	pthread_mutex_lock(&domains_lock);
 	_Atomic(HpDomain*)* target = &domains;
 	HpDomain* observed = atomic_load(target);
 
@@ -507,10 +553,13 @@ int hp_count_domains() {
 		observed = atomic_load(target);
 	}
 
+	pthread_mutex_unlock(&domains_lock);
+
 	return i;
 }
 
 void hp_clear_stats() {
+	pthread_mutex_lock(&domains_lock);
 	_Atomic(HpDomain*)* target = &domains;
 	HpDomain* observed = atomic_load(target);
 
@@ -533,9 +582,11 @@ void hp_clear_stats() {
 		target = &(observed->next);
 		observed = atomic_load(target);
 	}
+	pthread_mutex_unlock(&domains_lock);
 }
 
 HpStats* hp_gather_stats() {
+	pthread_mutex_lock(&domains_lock);
 	_Atomic(HpDomain*)* target = &domains;
 	HpDomain* observed = atomic_load(target);
 
@@ -568,6 +619,8 @@ HpStats* hp_gather_stats() {
 		observed = atomic_load(target);
 	}
 
+	pthread_mutex_unlock(&domains_lock);
+
 	return stats;
 }
 #endif
@@ -40,6 +40,9 @@ typedef struct hp_domain {
 	_Atomic(struct hp_domain*) next;
 	unsigned h;
 	unsigned k;
+	// called instead of free() on reclaimed pointers
+	void (*reclaim)(void* arg, int tid, void* p);
+	void* reclaim_arg;
 } HpDomain;
 
 // domain related functions
@@ -49,11 +52,21 @@ typedef struct hp_domain {
 // that can be protected at once
 HpDomain* hp_create(int k, int h);
 
+// hand reclaimed pointers to <reclaim> instead of free()
+// tid -> owner of the record being scanned
+// should be set before the domain is shared with other threads
+void hp_set_reclaim(HpDomain* d, void (*reclaim)(void* arg, int tid, void* p), void* arg);
+
 // THREAD UNSAFE!
 // should be called by the main thread
 // after no other thread is left
 void hp_destroy();
 
+// should be called once no thread uses d,
+// other domains may be created or destroyed meanwhile
+// reclaims what is left in d with its reclaim callback
+void hp_destroy_domain(HpDomain* d);
+
 // get new hazard pointers
 HpRecord* hp_alloc(HpDomain* d, int tid);
 void hp_release(HpDomain* d, HpRecord* hp);
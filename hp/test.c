@@ -8,9 +8,11 @@
 
 static void* pthread_test_par_protect(void* tid);
 static void* pthread_test_par_domains(void* tid);
+static void* pthread_test_par_destroy_domains(void* tid);
 static void test_par_protect();
 static void test_par_protect_roundrobin();
 static void test_par_domains();
+static void test_par_destroy_domains();
 static void test_seq_protect_multiple_entries();
 static void test_seq_protect_roundrobin_multiple_entries();
 static void test_seq_retire_multiple_entries();
@@ -18,6 +20,7 @@ static void test_seq_protect();
 static void test_seq_protect_roundrobin();
 static void test_seq_retire();
 static void test_seq_domains();
+static void test_seq_reclaim();
 static void test_quick_sort();
 static void test_binary_search();
 
@@ -31,6 +34,7 @@ static _Atomic(int*) shared[6] = {
 int main() {
 	// single threaded
 	test_seq_domains();
+	test_seq_reclaim();
 	test_seq_retire();
 	test_seq_protect();
 	test_seq_protect_roundrobin();
@@ -45,6 +49,7 @@ int main() {
 	test_par_protect();
 	test_par_protect_roundrobin();
 	test_par_domains();
+	test_par_destroy_domains();
 
 	test_quick_sort();
 	test_binary_search();
@@ -513,6 +518,84 @@ static void test_seq_retire() {
 	hp_destroy();
 }
 
+static int reclaimed_count;
+static void count_reclaim(void* arg, int tid, void* p) {
+	assert(arg == &reclaimed_count);
+	assert(tid == 0);
+	reclaimed_count++;
+	free(p);
+}
+
+static void test_seq_reclaim() {
+	printf("Single threaded - testing custom reclamation.\n");
+	int k = 2;
+	int h = 2;
+	int tid = 0;
+	HpDomain* d1 = hp_create(k, h);
+	hp_set_reclaim(d1, count_reclaim, &reclaimed_count);
+
+	int* v1 = (int*)malloc(1);
+	int* v2 = (int*)malloc(1);
+	int* v3 = (int*)malloc(1);
+	HpRecord* t1 = hp_alloc(d1, tid);
+
+	reclaimed_count = 0;
+	hp_protect(d1, t1, v1);
+	hp_retire(d1, tid, t1, v1);
+	hp_retire(d1, tid, t1, v2);
+	assert(reclaimed_count == 0);
+
+	// threshold reached, v1 is still protected
+	hp_retire(d1, tid, t1, v3);
+	assert(reclaimed_count == 2);
+
+	hp_release(d1, t1);
+	assert(reclaimed_count == 3);
+
+	hp_destroy();
+}
+
+static void* pthread_test_par_destroy_domains(void* tid) {
+	(void) tid;
+	int k = 1;
+	int t = 4;
+
+	for(int i = 0; i < 1000000; i++) {
+		HpDomain* d = hp_create(k, t);
+		hp_destroy_domain(d);
+	}
+	return NULL;
+}
+
+static void test_par_destroy_domains() {
+	printf("Multi threaded - testing domains destroyed while others come and go.\n");
+	int nproc = 4;
+	pthread_t* threads = (pthread_t*)malloc(nproc * sizeof(pthread_t));
+
+	// stays in the list throughout
+	HpDomain* kept = hp_create(1, 4);
+
+	for(int i = 0; i < nproc; i++) {
+		pthread_create(
+				&threads[i],
+				NULL,
+				pthread_test_par_destroy_domains,
+				(void*)(intptr_t)i);
+	}
+
+	for(int i = 0; i < nproc; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	assert(hp_count_domains() == 1);
+	assert(atomic_load(&domains) == kept);
+	assert(atomic_load(&(kept->next)) == NULL);
+
+	hp_destroy_domain(kept);
+	assert(hp_count_domains() == 0);
+	free(threads);
+}
+
 static void test_seq_domains() {
 	printf("Single threaded - testing domain management.\n");
 	int k = 1;
@@ -529,6 +612,27 @@ static void test_seq_domains() {
 
 	hp_destroy();
 	assert(hp_count_domains() == 0);
+
+	// a single domain goes, the others stay in order
+	d1 = hp_create(k, t);
+	d2 = hp_create(k, t);
+	d3 = hp_create(k, t);
+
+	hp_destroy_domain(d2);
+	assert(hp_count_domains() == 2);
+	assert(atomic_load(&(d1->next)) == d3);
+
+	hp_destroy_domain(d3);
+	assert(hp_count_domains() == 1);
+	assert(atomic_load(&(d1->next)) == NULL);
+
+	// the tail can take new domains again
+	d2 = hp_create(k, t);
+	assert(atomic_load(&(d1->next)) == d2);
+
+	hp_destroy_domain(d1);
+	hp_destroy_domain(d2);
+	assert(hp_count_domains() == 0);
 }
 
 static void test_quick_sort() {
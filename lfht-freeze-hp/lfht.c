@@ -1,6 +1,8 @@
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdatomic.h>
+#include <pthread.h>
 #include <hp.h>
 #include <lfht.h>
 
@@ -8,49 +10,243 @@ enum ntype {HASH, LEAF, FREEZE, UNFREEZE};
 
 struct lfht_node;
 
-static HpDomain* dom;
+// lean tables share the thread state of the first one (see
+// lean_share()), and their roots share a pool, under lean_lock
+static pthread_mutex_t lean_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct lfht_head *lean_shared;
+static struct lfht_pool *lean_roots;
+
+// compact leaves share a word with their type, they keep the hash
+// bits above the lowest LEAF_IMPLIED_BITS, which are the same for
+// every leaf of a root bucket
+#define LEAF_IMPLIED_BITS 16
 
 // a node of the trie
 // "size" = chunk size
 // on level hash_pos/size of the tree
 // hash_pos is incremented in chunks (see: get_bucket_index())
 // 2^size = length of "array" of buckets
+// with LFHT_FILTERS the array is followed by a filter per bucket
+// (see get_filter())
 struct lfht_node_hash {
-	int size;
-	int hash_pos;
-	_Atomic(struct lfht_node *) prev;
-	_Atomic(struct lfht_node *) array[0];
+	unsigned char size;
+	// chains are sorted the other way round (see leaf_after())
+	unsigned char reversed : 1;
+	// set on the roots (see is_root())
+	unsigned char root : 1;
+	short hash_pos;
+	// buckets that are not empty (see is_empty())
+	_Atomic(int) occupied;
+	// misses left before the level is compressed once empty
+	// (see defer_compress())
+	_Atomic(int) idle;
+	_Atomic(lfht_ref) prev;
+	_Atomic(lfht_ref) array[0];
 };
 
 // key-value pair node
+// fields are allocated up to the last one a node type uses:
+// next for FREEZE/UNFREEZE, hash for leaves and key_len for leaves
+// of keyed tables
+// compact leaves keep their hash with the type (see leaf_hash())
 struct lfht_node_leaf {
+	_Atomic(lfht_ref) next;
+	_Atomic(void *) value;
+#if !LFHT_COMPACT_LEAVES
 	size_t hash;
-	void *value;
-	_Atomic(struct lfht_node *) next;
+#endif
+	const void *key;
+	size_t key_len;
+};
+
+// removals replace the value with this marker before the leaf is
+// marked invalid, so values may be swapped in place (lfht_put)
+static char removed_value;
+#define REMOVED ((void *) &removed_value)
+
+// outcome of a compression, set once in the value of its freeze node
+// (see decide())
+static char committed_value;
+static char aborted_value;
+#define COMMITTED ((void *) &committed_value)
+#define ABORTED ((void *) &aborted_value)
+
+// key of keyed operations, NULL on the integer interface
+struct lfht_key {
+	const void *ptr;
+	size_t len;
+};
+
+// bucket chain as seen by lookup() on behalf of insertions
+struct lfht_chain {
+	// next field of the last node, where new levels go
+	_Atomic(lfht_ref) *tail;
+	// length of the chain
+	unsigned int count;
+	// hash bits in which the leaves of the chain differ from hash
+	size_t diff;
+	// where a new leaf goes: the next field (or bucket) before it
+	// and the node it must point to
+	_Atomic(lfht_ref) *slot;
+	struct lfht_node *next;
+};
+
+#if LFHT_JUMP_CACHE
+// hash nodes reached by lookups of hashes that share the jump_bits
+// lowest bits of prefix: anchor, the deepest one at most jump_bits
+// down, serves them all, deep only those of its own prefix
+// (deep_pos bits, kept here as the node may be gone)
+struct lfht_jump {
+	size_t prefix;
+	struct lfht_node *anchor;
+	struct lfht_node *deep;
+	int deep_pos;
+	unsigned long epoch;
 };
+#endif
 
+// the type stays in the node rather than in spare bits of the
+// pointers to it: traversals read the node right after testing its
+// type (hash and next of leaves, size and hash_pos of hash nodes),
+// which share the cache line of the type, so a tag saves no miss
 struct lfht_node {
+#if LFHT_COMPACT_LEAVES
+	enum ntype type : 16;
+	size_t hash_high : 48;
+#else
 	enum ntype type;
+#endif
 	union {
 		struct lfht_node_hash hash;
 		struct lfht_node_leaf leaf;
 	};
 };
 
+// memory pools
+//
+// nodes are carved out of slabs owned by the allocating thread,
+// segregated by size class (leaves, compression nodes and one class
+// per hash node width).
+// slabs are aligned to their own size, so the slab (and the pool)
+// a node belongs to is found by masking the node address.
+// nodes freed by any other thread are pushed onto a remote queue of
+// the owner pool, which is drained once the local free list runs dry.
+#define POOL_SLAB_SIZE (1<<16)
+#define POOL_MAX_HASH_SIZE 10
+// 32 byte leaves stay within a cache line, compact ones of 24 bytes
+// are packed at the word size
+#if LFHT_COMPACT_LEAVES
+#define POOL_ALIGN 8
+#else
+#define POOL_ALIGN 16
+#endif
+
+enum pool_class {LEAF_CLASS, KEY_LEAF_CLASS, FREEZE_CLASS, HASH_CLASS};
+
+#define POOL_CLASSES (HASH_CLASS + POOL_MAX_HASH_SIZE + 1)
+
+struct lfht_slab {
+	// NULL on standalone allocations (e.g. the root hash node)
+	struct lfht_pool *owner;
+	struct lfht_slab *next;
+	int size_class;
+#if LFHT_REFS
+	unsigned int id;
+#endif
+};
+
+#define SLAB_HEADER_SIZE \
+	((sizeof(struct lfht_slab) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+// a free node is linked through its first word
+struct lfht_free_node {
+	struct lfht_free_node *next;
+};
+
+struct lfht_pool {
+	// pushed to by other threads
+	_Alignas(CACHE_SIZE) _Atomic(struct lfht_free_node *) remote[POOL_CLASSES];
+
+	// owner thread only
+	_Alignas(CACHE_SIZE) struct lfht_free_node *free_list[POOL_CLASSES];
+	char *bump[POOL_CLASSES];
+	char *end[POOL_CLASSES];
+	struct lfht_slab *slabs;
+};
+
+// leaves inserted minus leaves removed by one thread
+// written by its owner only, summed by lfht_size_approx()
+struct lfht_size {
+	_Alignas(CACHE_SIZE) _Atomic(long) delta;
+};
+
+// shared state of the threads of lfht_bulk_load()
+// the keys of root bucket b are order[start[b]] to order[start[b+1]-1]
+struct lfht_bulk {
+	struct lfht_head *lfht;
+	const size_t *hashes;
+	void **values;
+	size_t n;
+	int nthreads;
+	size_t *order;
+	size_t *scratch;
+	// per thread histograms of root buckets, then scatter offsets
+	size_t *offsets;
+	size_t *start;
+	_Atomic(size_t) next_bucket;
+	pthread_barrier_t barrier;
+};
+
+struct lfht_bulk_thread {
+	struct lfht_bulk *bulk;
+	int thread_id;
+};
+
+// in-flight traversal of lfht_search_batch()
+// bucket -> set while the bucket is yet to be loaded,
+//           otherwise iter is the next node to visit
+struct lfht_batch_slot {
+	int index;
+	struct lfht_node *hnode;
+	_Atomic(lfht_ref) *bucket;
+	struct lfht_node *iter;
+};
+
 // private functions
 
 void search_remove(
 		struct lfht_head *lfht,
 		int thread_id,
 		struct lfht_node *hnode,
-		size_t hash);
+		size_t hash,
+		const struct lfht_key *key);
+
+void *search_insert(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash,
+		const struct lfht_key *key,
+		void *value,
+		int replace,
+		int *inserted);
+
+void *search_compute(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash,
+		const struct lfht_key *key,
+		lfht_compute_fn fn,
+		void *ctx);
 
-void search_insert(
+size_t search_fetch_add(
 		struct lfht_head *lfht,
 		int thread_id,
 		struct lfht_node *hnode,
 		size_t hash,
-		void *value);
+		const struct lfht_key *key,
+		size_t delta);
 
 int compress(
 		struct lfht_head *lfht,
@@ -70,7 +266,60 @@ void abort_compress(
 		struct lfht_node *target,
 		struct lfht_node *freeze,
 		struct lfht_node *head,
-		_Atomic(struct lfht_node *) *atomic_bucket);
+		_Atomic(lfht_ref) *atomic_bucket);
+
+void *decide(
+		struct lfht_node *freeze,
+		void *outcome);
+
+unsigned level_population(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		unsigned limit);
+
+void try_merge(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash);
+
+unsigned merge_pending(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash);
+
+int merge(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash);
+
+int merge_bucket(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		struct lfht_node *parent,
+		struct lfht_node **target,
+		size_t hash);
+
+int link_target(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		struct lfht_node *owner,
+		_Atomic(lfht_ref) *bucket,
+		struct lfht_node **target,
+		struct lfht_node *fresh,
+		size_t hash);
+
+void retire_merged(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *level,
+		struct lfht_node *replace,
+		size_t hash);
 
 int help_expansion(
 		struct lfht_head *lfht,
@@ -84,33 +333,247 @@ int expand(
 		int thread_id,
 		struct lfht_node **new_hash,
 		struct lfht_node *hnode,
+		int size,
 		size_t hash,
-		_Atomic(struct lfht_node *) *tail_nxt_ptr);
+		_Atomic(lfht_ref) *tail_nxt_ptr);
+
+void stop_root_growth(
+		struct lfht_head *lfht,
+		struct lfht_node *root);
+
+void grow_root(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *root);
+
+int grow_bucket(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *root,
+		struct lfht_node **next,
+		size_t b);
+
+int expansion_size(
+		struct lfht_head *lfht,
+		struct lfht_node *hnode,
+		size_t diff,
+		size_t count);
 
 int adjust_chain_nodes(
 		struct lfht_head *lfht,
 		int thread_id,
 		struct lfht_node *hnode,
-		struct lfht_node *head);
+		struct lfht_node *head,
+		size_t hash);
 
-void adjust_node(
+int adjust_node(
 		struct lfht_head *lfht,
 		int thread_id,
 		struct lfht_node *cnode,
 		struct lfht_node *nxt,
-		struct lfht_node *hnode);
+		struct lfht_node *hnode,
+		size_t hash);
+
+int merge_tail(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *cnode,
+		size_t hash,
+		struct lfht_node **hnode,
+		_Atomic(lfht_ref) **tail,
+		struct lfht_node **expect);
 
 void *search_node(
 		struct lfht_head *lfht,
 		int thread_id,
 		struct lfht_node *hnode,
-		size_t hash);
+		size_t hash,
+		const struct lfht_key *key);
+
+int batch_step(
+		struct lfht_head *lfht,
+		int thread_id,
+		HpRecord *hp,
+		struct lfht_batch_slot *slot,
+		size_t hash,
+		void **values);
+
+void *bulk_load_thread(void *arg);
+
+struct lfht_node *bulk_build(
+		struct lfht_bulk *bulk,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t *keys,
+		size_t *scratch,
+		size_t count);
+
+size_t bulk_dedupe(
+		struct lfht_bulk *bulk,
+		size_t *keys,
+		size_t *scratch,
+		size_t count);
+
+void bulk_free(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *node,
+		struct lfht_node *hnode);
+
+size_t reverse_bits(size_t x);
+
+int iter_snapshot(
+		struct lfht_iter *iter,
+		size_t hash,
+		size_t *end,
+		int *bits);
+
+void add_size(
+		struct lfht_head *lfht,
+		int thread_id,
+		long delta);
 
 struct lfht_node *create_hash_node(
+		struct lfht_head *lfht,
+		int thread_id,
 		int size,
 		int hash_pos,
 		struct lfht_node *prev);
 
+struct lfht_pool *create_pool();
+
+void free_pool(struct lfht_pool *pool);
+
+size_t hash_node_size(int size);
+
+void *pool_take(
+		struct lfht_pool *pool,
+		int size_class);
+
+void *pool_carve(
+		struct lfht_pool *pool,
+		int size_class);
+
+void *node_alloc(
+		struct lfht_head *lfht,
+		int thread_id,
+		int size_class);
+
+void *standalone_alloc(size_t size);
+
+void *lean_alloc(int size_class);
+
+struct lfht_head *lean_share(
+		int max_threads,
+		struct lfht_config *config);
+
+void free_level(
+		struct lfht_head *lfht,
+		struct lfht_node *hnode);
+
+void free_roots(struct lfht_head *lfht);
+
+void node_free(
+		struct lfht_head *lfht,
+		int thread_id,
+		void *node);
+
+void reclaim_node(
+		void *lfht,
+		int thread_id,
+		void *node);
+
+#if LFHT_REFS
+void ref_register(struct lfht_slab *slab);
+
+void ref_release(struct lfht_slab *slab);
+#endif
+
+lfht_ref to_ref(struct lfht_node *node);
+
+struct lfht_node *from_ref(lfht_ref ref);
+
+struct lfht_node *ref_load(
+		_Atomic(lfht_ref) *ref,
+		memory_order order);
+
+void ref_init(
+		_Atomic(lfht_ref) *ref,
+		struct lfht_node *node);
+
+void ref_store(
+		_Atomic(lfht_ref) *ref,
+		struct lfht_node *node,
+		memory_order order);
+
+int ref_cas(
+		_Atomic(lfht_ref) *ref,
+		struct lfht_node **expected,
+		struct lfht_node *desired,
+		memory_order success,
+		memory_order failure);
+
+_Atomic(lfht_ref) *get_atomic_bucket(
+		size_t hash,
+		struct lfht_node *hnode);
+
+#if LFHT_FILTERS
+_Atomic(uint64_t) *get_filter(
+		size_t hash,
+		struct lfht_node *hnode);
+
+uint64_t filter_bit(
+		size_t hash,
+		struct lfht_node *hnode);
+
+void filter_begin(
+		size_t hash,
+		struct lfht_node *hnode,
+		uint64_t bits);
+
+void filter_end(
+		size_t hash,
+		struct lfht_node *hnode);
+
+void filter_update(
+		size_t hash,
+		struct lfht_node *hnode,
+		uint64_t filter,
+		uint64_t seen);
+#endif
+
+#if LFHT_JUMP_CACHE
+struct lfht_node *jump_get(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash);
+
+void jump_put(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash,
+		struct lfht_node *hnode);
+#endif
+
+struct lfht_node *dir_get(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash);
+
+void dir_set(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash,
+		struct lfht_node *expect,
+		struct lfht_node *hnode);
+
+void dir_replace(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash,
+		struct lfht_node *expect,
+		struct lfht_node *hnode);
+
 struct lfht_node *get_next(
 		struct lfht_node *node);
 
@@ -127,10 +590,67 @@ unsigned is_invalid(struct lfht_node *ptr);
 
 unsigned is_compression_node(struct lfht_node *node);
 
+unsigned moved_on(
+		struct lfht_node *owner,
+		struct lfht_node *nxt);
+
 unsigned is_compressed(struct lfht_node *node);
 
+unsigned is_root(struct lfht_node *hnode);
+
+unsigned is_merge_target(
+		struct lfht_node *hnode,
+		struct lfht_node *target);
+
 unsigned is_empty(struct lfht_node *hnode);
 
+int count_bucket(
+		struct lfht_node *hnode,
+		int delta);
+
+void defer_compress(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode);
+
+unsigned is_idle_over(struct lfht_node *hnode);
+
+void reuse_level(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode);
+
+unsigned is_removed(struct lfht_node *node);
+
+int mark_invalid(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		struct lfht_node *cnode,
+		struct lfht_node **nxt_ptr,
+		size_t hash);
+
+struct lfht_node *protect_behind(
+		struct lfht_head *lfht,
+		int thread_id,
+		_Atomic(lfht_ref) *bucket,
+		struct lfht_node *head);
+
+size_t leaf_hash(
+		struct lfht_node *leaf,
+		size_t hash);
+
+unsigned leaf_match(
+		struct lfht_head *lfht,
+		struct lfht_node *leaf,
+		size_t hash,
+		const struct lfht_key *key);
+
+unsigned leaf_after(
+		struct lfht_node *hnode,
+		struct lfht_node *leaf,
+		size_t hash);
+
 // public functions
 // defined by the header API
 
@@ -147,29 +667,164 @@ struct lfht_head *init_lfht_explicit(
 		int root_hash_size,
 		int hash_size,
 		int max_chain_nodes) {
-	struct lfht_head *lfht = malloc(sizeof(struct lfht_head));
+	struct lfht_config config;
+	lfht_default_config(&config);
+	config.root_hash_size = root_hash_size;
+	config.hash_size = hash_size;
+	config.max_chain_nodes = max_chain_nodes;
 
-	int k = max_chain_nodes + 3;
-	dom = hp_create(k, 10000);
-	//dom = hp_create(k, max_threads * k + max_threads * k / 2);
-	//dom = hp_create(k, 0);
+	return init_lfht_config(max_threads, &config);
+}
 
-	lfht->entry_hash = create_hash_node(root_hash_size, 0, NULL);
-	lfht->max_threads = max_threads;
-	lfht->root_hash_size = root_hash_size;
-	lfht->hash_size = hash_size;
-	lfht->max_chain_nodes = max_chain_nodes;
-#if LFHT_STATS
-	lfht->stats = (_Atomic(struct lfht_stats*) *)
-		malloc(max_threads*sizeof(_Atomic(struct lfht_stats*)));
+void lfht_default_config(struct lfht_config *config) {
+	config->root_hash_size = ROOT_HASH_SIZE;
+	config->max_root_hash_size = 0;
+	config->hash_size = HASH_SIZE;
+	config->min_hash_size = 0;
+	config->max_hash_size = 0;
+	config->max_chain_nodes = MAX_NODES;
+	config->sorted_chains = 0;
+	config->dir_bits = 0;
+	config->compress_delay = 0;
+	config->merge_levels = 0;
+	config->lean = 0;
+	config->key_hash = NULL;
+	config->key_eq = NULL;
+}
 
-	for(int i = 0; i < lfht->max_threads; i++) {
-		atomic_init(&(lfht->stats[i]), NULL);
+struct lfht_head *init_lfht_config(
+		int max_threads,
+		struct lfht_config *config) {
+	struct lfht_head *lfht = malloc(sizeof(struct lfht_head));
+	lfht->lean = config->lean;
+
+	int k = config->max_chain_nodes + 3;
+	if(lfht->lean) {
+		pthread_mutex_lock(&lean_lock);
+		if(!lean_shared) {
+			lean_shared = lean_share(max_threads, config);
+		}
+		pthread_mutex_unlock(&lean_lock);
+		if(max_threads > lean_shared->max_threads) {
+			// the shared per thread arrays are too short
+			free(lfht);
+			return NULL;
+		}
+		lfht->dom = lean_shared->dom;
+		max_threads = lean_shared->max_threads;
+	} else {
+		lfht->dom = hp_create(k, 10000);
+		//lfht->dom = hp_create(k, max_threads * k + max_threads * k / 2);
+		//lfht->dom = hp_create(k, 0);
+
+		// reclaimed nodes go back to their pools
+		hp_set_reclaim(lfht->dom, reclaim_node, lfht);
 	}
 
-	lfht->hazard_pointers = (HpRecord**)malloc(lfht->max_threads * sizeof(HpRecord*));
+	int root_hash_size = config->root_hash_size;
+#if LFHT_COMPACT_LEAVES
+	// the hash bits leaves leave out must come from the root
+	if(root_hash_size < LEAF_IMPLIED_BITS) {
+		root_hash_size = LEAF_IMPLIED_BITS;
+	}
+#endif
+
+	lfht->max_threads = max_threads;
+	lfht->base_hash = create_hash_node(lfht, -1, root_hash_size, 0, NULL);
+	lfht->base_hash->hash.root = 1;
+	atomic_init(&(lfht->entry_hash), lfht->base_hash);
+	lfht->root_hash_size = root_hash_size;
+	lfht->max_root_hash_size = config->max_root_hash_size > root_hash_size ?
+		config->max_root_hash_size : root_hash_size;
+	lfht->hash_size = config->hash_size;
+	lfht->min_hash_size = config->min_hash_size > 0 &&
+		config->min_hash_size < config->hash_size ?
+		config->min_hash_size : config->hash_size;
+	lfht->max_hash_size = config->max_hash_size > config->hash_size ?
+		config->max_hash_size : config->hash_size;
+	lfht->max_chain_nodes = config->max_chain_nodes;
+	if(lfht->lean && lfht->max_chain_nodes + 3 > lfht->dom->k) {
+		// the hazard pointers of a thread are those of the first one
+		lfht->max_chain_nodes = lfht->dom->k - 3;
+	}
+	lfht->sorted_chains = config->sorted_chains;
+	lfht->dir_bits = config->dir_bits;
+	lfht->compress_delay = config->compress_delay > 0 ?
+		config->compress_delay : 0;
+	lfht->merge_levels = config->merge_levels && !config->sorted_chains;
+	lfht->dir = NULL;
+	if(lfht->dir_bits > 0) {
+		if(lfht->dir_bits < root_hash_size) {
+			lfht->dir_bits = root_hash_size;
+		}
+		lfht->dir = malloc(((size_t) 1 << lfht->dir_bits) * sizeof(lfht_ref));
+		for(size_t i = 0; i < (size_t) 1 << lfht->dir_bits; i++) {
+			ref_init(&(lfht->dir[i]), lfht->entry_hash);
+		}
+	}
+	lfht->key_eq = config->key_eq;
+	lfht->key_hash = config->key_hash;
+#if LFHT_JUMP_CACHE
+	atomic_init(&(lfht->jump_epoch), 0);
+	lfht->jump_bits = lfht->max_root_hash_size + config->hash_size;
+	if(lfht->jump_bits > (int) (8 * sizeof(size_t))) {
+		lfht->jump_bits = 8 * sizeof(size_t);
+	}
+#endif
+
+	if(lfht->key_eq && !lfht->key_hash) {
+		lfht->key_hash = lfht_hash_bytes;
+	}
+	lfht->lean_sizes = NULL;
+#if LFHT_STATS
+	if(lfht->lean) {
+		lfht->stats = lean_shared->stats;
+		lfht->hazard_pointers = lean_shared->hazard_pointers;
+		lfht->batch_hazard_pointers = lean_shared->batch_hazard_pointers;
+		lfht->merge_hazard_pointers = lean_shared->merge_hazard_pointers;
+		lfht->pools = lean_shared->pools;
+		lfht->sizes = NULL;
+		lfht->lean_sizes = (_Atomic(_Atomic(long)*) *)
+			malloc(max_threads * sizeof(_Atomic(_Atomic(long)*)));
+		for(int i = 0; i < max_threads; i++) {
+			atomic_init(&(lfht->lean_sizes[i]), NULL);
+		}
+#if LFHT_JUMP_CACHE
+		lfht->jumps = NULL;
+#endif
+		if(lfht->max_threads <= 1) {
+			lfht_init_thread(lfht, 0);
+		}
+		return lfht;
+	}
+
+	lfht->stats = (_Atomic(struct lfht_stats*) *)
+		malloc(max_threads*sizeof(_Atomic(struct lfht_stats*)));
+
+	for(int i = 0; i < lfht->max_threads; i++) {
+		atomic_init(&(lfht->stats[i]), NULL);
+	}
+
+	lfht->hazard_pointers = (HpRecord**)malloc(lfht->max_threads * sizeof(HpRecord*));
+	lfht->batch_hazard_pointers = (HpRecord***)malloc(lfht->max_threads * sizeof(HpRecord**));
+	lfht->merge_hazard_pointers = lfht->merge_levels ?
+		(HpRecord**)malloc(lfht->max_threads * sizeof(HpRecord*)) : NULL;
+	lfht->pools = (struct lfht_pool**)malloc(lfht->max_threads * sizeof(struct lfht_pool*));
+#if LFHT_JUMP_CACHE
+	lfht->jumps = (struct lfht_jump**)malloc(lfht->max_threads * sizeof(struct lfht_jump*));
+#endif
+	lfht->sizes = (struct lfht_size*)aligned_alloc(CACHE_SIZE, lfht->max_threads * sizeof(struct lfht_size));
 	for(int i = 0; i < lfht->max_threads; i++) {
+		atomic_init(&(lfht->sizes[i].delta), 0);
 		lfht->hazard_pointers[i] = NULL;
+		lfht->batch_hazard_pointers[i] = NULL;
+		if(lfht->merge_hazard_pointers) {
+			lfht->merge_hazard_pointers[i] = NULL;
+		}
+		lfht->pools[i] = NULL;
+#if LFHT_JUMP_CACHE
+		lfht->jumps[i] = NULL;
+#endif
 	}
 
 	if(lfht->max_threads <= 1) {
@@ -180,9 +835,57 @@ struct lfht_head *init_lfht_explicit(
 }
 
 void free_lfht(struct lfht_head *lfht) {
-	hp_destroy();
+	if(lfht->lean) {
+		// the pools and the domain stay for the other lean tables
+		free_level(lfht, lfht->entry_hash);
+		free_roots(lfht);
+		for(int i = 0; i < lfht->max_threads; i++) {
+			_Atomic(long) *slot = atomic_load_explicit(
+					&(lfht->lean_sizes[i]),
+					memory_order_relaxed);
+			if(slot) {
+				node_free(lfht, -1, slot);
+			}
+		}
+		free(lfht->lean_sizes);
+		free(lfht->dir);
+		free(lfht);
+		return;
+	}
+
+	// the other tables keep their domains
+	hp_destroy_domain(lfht->dom);
 	free(lfht->hazard_pointers);
 	lfht->hazard_pointers = NULL;
+	for(int i = 0; i < lfht->max_threads; i++) {
+		free(lfht->batch_hazard_pointers[i]);
+	}
+	free(lfht->batch_hazard_pointers);
+	lfht->batch_hazard_pointers = NULL;
+	free(lfht->merge_hazard_pointers);
+	lfht->merge_hazard_pointers = NULL;
+
+	// every node but the root lives in the pools
+	for(int i = 0; i < lfht->max_threads; i++) {
+		if(lfht->pools[i]) {
+			free_pool(lfht->pools[i]);
+		}
+	}
+	free(lfht->pools);
+	lfht->pools = NULL;
+#if LFHT_JUMP_CACHE
+	for(int i = 0; i < lfht->max_threads; i++) {
+		free(lfht->jumps[i]);
+	}
+	free(lfht->jumps);
+	lfht->jumps = NULL;
+#endif
+	free(lfht->sizes);
+	lfht->sizes = NULL;
+	free(lfht->dir);
+	lfht->dir = NULL;
+
+	free_roots(lfht);
 
 #if LFHT_STATS
 	for(int i = 0; i < lfht->max_threads; i++) {
@@ -190,15 +893,35 @@ void free_lfht(struct lfht_head *lfht) {
 	}
 	free(lfht->stats);
 #endif
+	free(lfht);
 }
 
 int lfht_init_thread(struct lfht_head *lfht, int thread_id)
 {
 	if(!lfht->hazard_pointers[thread_id]) {
-		lfht->hazard_pointers[thread_id] = hp_alloc(dom, thread_id);
+		lfht->hazard_pointers[thread_id] = hp_alloc(lfht->dom, thread_id);
+	}
+
+	if(lfht->merge_hazard_pointers && !lfht->merge_hazard_pointers[thread_id]) {
+		lfht->merge_hazard_pointers[thread_id] = hp_alloc(lfht->dom, thread_id);
+	}
+
+	if(!lfht->pools[thread_id]) {
+		lfht->pools[thread_id] = create_pool();
+	}
+
+#if LFHT_JUMP_CACHE
+	if(lfht->jumps && !lfht->jumps[thread_id]) {
+		lfht->jumps[thread_id] = calloc(JUMP_SLOTS, sizeof(struct lfht_jump));
 	}
+#endif
 
 #if LFHT_STATS
+	if(lfht->lean && lfht->stats[thread_id]) {
+		// set up by another lean table
+		return thread_id;
+	}
+
 	size_t stats_size = CACHE_SIZE * ((sizeof(struct lfht_stats) / CACHE_SIZE) + 1);
 	struct lfht_stats *s = (struct lfht_stats *) aligned_alloc(CACHE_SIZE, stats_size);
 	s->compression_counter = 0;
@@ -217,6 +940,14 @@ int lfht_init_thread(struct lfht_head *lfht, int thread_id)
 	s->lookups = 0;
 	s->memory_alloc = 0;
 	s->memory_free = 0;
+	s->pool_hits = 0;
+	s->pool_misses = 0;
+	s->pool_remote_frees = 0;
+	s->dir_updates = 0;
+	s->deferred_compression_counter = 0;
+	s->avoided_compression_counter = 0;
+	s->merge_counter = 0;
+	s->root_growth_counter = 0;
 
 	for(int i = 0; i < lfht->max_threads; i++) {
 		struct lfht_stats *expect = NULL;
@@ -239,9 +970,28 @@ int lfht_init_thread(struct lfht_head *lfht, int thread_id)
 
 void lfht_end_thread(struct lfht_head *lfht, int thread_id)
 {
-	hp_release(dom, lfht->hazard_pointers[thread_id]);
+	if(lfht->lean) {
+		// the other lean tables may still use the thread
+		return;
+	}
+
+	hp_release(lfht->dom, lfht->hazard_pointers[thread_id]);
 	lfht->hazard_pointers[thread_id] = NULL;
 
+	HpRecord **batch = lfht->batch_hazard_pointers[thread_id];
+	if(batch) {
+		for(int i = 0; i < BATCH_SLOTS; i++) {
+			hp_release(lfht->dom, batch[i]);
+		}
+		free(batch);
+		lfht->batch_hazard_pointers[thread_id] = NULL;
+	}
+
+	if(lfht->merge_hazard_pointers) {
+		hp_release(lfht->dom, lfht->merge_hazard_pointers[thread_id]);
+		lfht->merge_hazard_pointers[thread_id] = NULL;
+	}
+
 #if LFHT_STATS
 	struct lfht_stats *s = lfht->stats[thread_id];
 	clock_gettime(CLOCK_MONOTONIC_RAW, &(s->term));
@@ -262,7 +1012,70 @@ void *lfht_search(
 			lfht,
 			thread_id,
 			lfht->entry_hash,
-			hash);
+			hash,
+			NULL);
+}
+
+void lfht_search_batch(
+		struct lfht_head *lfht,
+		const size_t *hashes,
+		void **values,
+		int n,
+		int thread_id)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	// accounted as n searches
+	stats->api_calls += n;
+	stats->searches += n;
+	stats->operations += n;
+	stats->lookups += n;
+	stats->max_retry_counter += n;
+#endif
+	// each slot protects its own path
+	// records are only taken by threads that batch, as they add to
+	// the cost of every scan of the domain
+	HpRecord **hps = lfht->batch_hazard_pointers[thread_id];
+	if(!hps) {
+		hps = (HpRecord**)malloc(BATCH_SLOTS * sizeof(HpRecord*));
+		for(int i = 0; i < BATCH_SLOTS; i++) {
+			hps[i] = hp_alloc(lfht->dom, thread_id);
+		}
+		lfht->batch_hazard_pointers[thread_id] = hps;
+	}
+
+	struct lfht_batch_slot slots[BATCH_SLOTS];
+	for(int i = 0; i < BATCH_SLOTS; i++) {
+		slots[i].index = -1;
+	}
+
+	// round robin over the slots, each one advances a single node
+	// while the nodes prefetched by the others are on their way
+	int next = 0;
+	int active = 0;
+	while(next < n || active > 0) {
+		for(int i = 0; i < BATCH_SLOTS; i++) {
+			struct lfht_batch_slot *slot = &(slots[i]);
+
+			if(slot->index < 0) {
+				if(next >= n) {
+					continue;
+				}
+
+				slot->index = next++;
+				slot->hnode = lfht->entry_hash;
+				slot->bucket = get_atomic_bucket(hashes[slot->index], slot->hnode);
+				__builtin_prefetch(slot->bucket);
+				active++;
+				continue;
+			}
+
+			if(batch_step(lfht, thread_id, hps[i], slot, hashes[slot->index], values)) {
+				slot->index = -1;
+				active--;
+			}
+		}
+	}
 }
 
 void lfht_insert(
@@ -281,1068 +1094,4447 @@ void lfht_insert(
 			thread_id,
 			lfht->entry_hash,
 			hash,
-			value);
+			NULL,
+			value,
+			0,
+			NULL);
 }
 
-void lfht_remove(
+void *lfht_put(
 		struct lfht_head *lfht,
 		size_t hash,
+		void *value,
 		int thread_id)
 {
 #if LFHT_STATS
 	struct lfht_stats* stats = lfht->stats[thread_id];
 	stats->api_calls++;
-	stats->removes++;
+	stats->inserts++;
 #endif
-	search_remove(
+	return search_insert(
 			lfht,
 			thread_id,
 			lfht->entry_hash,
-			hash);
-}
-
-// auxiliary functions
-
-struct lfht_node *create_freeze_node(
-		struct lfht_node *next)
-{
-	struct lfht_node *node = malloc(sizeof(struct lfht_node));
-	node->type = FREEZE;
-	node->leaf.hash = 0;
-	node->leaf.value = NULL;
-
-	atomic_init(&(node->leaf.next), next);
-
-	return node;
-}
-
-struct lfht_node *create_unfreeze_node(
-		struct lfht_node *next)
-{
-	struct lfht_node *node = malloc(sizeof(struct lfht_node));
-	node->type = UNFREEZE;
-	node->leaf.hash = 0;
-	node->leaf.value = NULL;
-
-	atomic_init(&(node->leaf.next), next);
-
-	return node;
+			hash,
+			NULL,
+			value,
+			1,
+			NULL);
 }
 
-struct lfht_node *create_leaf_node(
+void *lfht_insert_if_absent(
+		struct lfht_head *lfht,
 		size_t hash,
 		void *value,
-		struct lfht_node *next)
+		int thread_id)
 {
-	struct lfht_node *node = malloc(sizeof(struct lfht_node));
-	node->type = LEAF;
-	node->leaf.hash = hash;
-	node->leaf.value = value;
-
-	atomic_init(&(node->leaf.next), next);
-
-	return node;
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->inserts++;
+#endif
+	return search_insert(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			hash,
+			NULL,
+			value,
+			0,
+			NULL);
 }
 
-struct lfht_node *create_hash_node(
-		int size,
-		int hash_pos,
-		struct lfht_node *prev)
+void *lfht_compute(
+		struct lfht_head *lfht,
+		size_t hash,
+		lfht_compute_fn fn,
+		void *ctx,
+		int thread_id)
 {
-	struct lfht_node *node = malloc(
-			sizeof(struct lfht_node) + (1<<size)*sizeof(struct lfht_node *));
-	node->type = HASH;
-	node->hash.size = size;
-	node->hash.hash_pos = hash_pos;
-	node->hash.prev = prev;
-	for(int i=0; i < 1<<size; i++) {
-		atomic_init(&(node->hash.array[i]), node);
-	}
-	return node;
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->inserts++;
+#endif
+	return search_compute(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			hash,
+			NULL,
+			fn,
+			ctx);
 }
 
-// for the current hash level, return the chunk of the
-// hash which indexes the bucket array (of size 2^w)
-int get_bucket_index(
+size_t lfht_fetch_add(
+		struct lfht_head *lfht,
 		size_t hash,
-		int hash_pos,
-		int size)
+		size_t delta,
+		int thread_id)
 {
-	// hash_pos does not increment 1 by 1
-	// it increments with the chunk size
-	return (hash >> hash_pos) & ((1 << size) - 1);
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->inserts++;
+#endif
+	return search_fetch_add(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			hash,
+			NULL,
+			delta);
 }
 
-_Atomic(struct lfht_node *) *get_atomic_bucket(
+void lfht_remove(
+		struct lfht_head *lfht,
 		size_t hash,
-		struct lfht_node *hnode)
+		int thread_id)
 {
-	int pos = get_bucket_index(
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->removes++;
+#endif
+	search_remove(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
 			hash,
-			hnode->hash.hash_pos,
-			hnode->hash.size);
-
-	return &(hnode->hash.array[pos]);
+			NULL);
 }
 
-// release-consume order get next
-struct lfht_node *get_next(
-		struct lfht_node *node)
+void *lfht_search_key(
+		struct lfht_head *lfht,
+		const void *key,
+		size_t len,
+		int thread_id)
 {
-	//return atomic_load_explicit(
-	//		&(node->leaf.next),
-	//		memory_order_consume);
-
-	// avoiding hazards during compress operation WIP
-	struct lfht_node* nxt = atomic_load_explicit(
-			&(node->leaf.next),
-			memory_order_seq_cst);
-
-	return nxt;
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->searches++;
+#endif
+	struct lfht_key k = {key, len};
+	return search_node(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			lfht->key_hash(key, len),
+			&k);
 }
 
-struct lfht_node *get_prev(
+void lfht_insert_key(
 		struct lfht_head *lfht,
-		int thread_id,
-		struct lfht_node *hnode)
+		const void *key,
+		size_t len,
+		void *value,
+		int thread_id)
 {
-	struct lfht_node* prev = atomic_load_explicit(
-			&(hnode->hash.prev),
-			memory_order_seq_cst);
-
-	if(!prev) {
-		return lfht->entry_hash;
-	}
-
-	HpRecord* hp = lfht->hazard_pointers[thread_id];
-
-	hp_protect(dom, hp, prev);
-	if(prev != atomic_load_explicit(
-			&(hnode->hash.prev),
-			memory_order_seq_cst)) {
-		// hazard pointer not safe
-		return lfht->entry_hash;
-	}
-
-	// prev protected successfully
-	return prev;
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->inserts++;
+#endif
+	struct lfht_key k = {key, len};
+	search_insert(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			lfht->key_hash(key, len),
+			&k,
+			value,
+			0,
+			NULL);
 }
 
-// we do not use an "is_valid" field.
-// to verify if a node is valid, the least significant bit
-// of the *next field is used (the address, not the node it
-// points to).
-//
-// validating a node using the mask ~1:
-// 0xFFFF & ~1 === 0xFFFF & 0xFFFE = 0xFFFE
-//
-// invalidating a node:
-// 0xFFFE | 1 === 0xFFFE | 0x0001 = 0xFFFF
-//
-// arg: the *next address of the node we want to invalidate
-// return: pointer masked with "valid"
-struct lfht_node *valid_ptr(struct lfht_node *next)
+void *lfht_put_key(
+		struct lfht_head *lfht,
+		const void *key,
+		size_t len,
+		void *value,
+		int thread_id)
 {
-	return (struct lfht_node *) ((uintptr_t) next & ~1);
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->inserts++;
+#endif
+	struct lfht_key k = {key, len};
+	return search_insert(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			lfht->key_hash(key, len),
+			&k,
+			value,
+			1,
+			NULL);
 }
 
-struct lfht_node *invalid_ptr(struct lfht_node *next)
+void *lfht_insert_if_absent_key(
+		struct lfht_head *lfht,
+		const void *key,
+		size_t len,
+		void *value,
+		int thread_id)
 {
-	return (struct lfht_node *) ((uintptr_t) next | 1);
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->inserts++;
+#endif
+	struct lfht_key k = {key, len};
+	return search_insert(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			lfht->key_hash(key, len),
+			&k,
+			value,
+			0,
+			NULL);
 }
 
-// mask address to get the valid/invalid bit flag
-// 
-// arg: the *next address of the node
-// return: the least significant bit of *next
-unsigned is_invalid(struct lfht_node *ptr)
+void *lfht_compute_key(
+		struct lfht_head *lfht,
+		const void *key,
+		size_t len,
+		lfht_compute_fn fn,
+		void *ctx,
+		int thread_id)
 {
-	return (uintptr_t) ptr & 1;
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->inserts++;
+#endif
+	struct lfht_key k = {key, len};
+	return search_compute(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			lfht->key_hash(key, len),
+			&k,
+			fn,
+			ctx);
 }
 
-unsigned is_compressed(struct lfht_node *hnode)
+size_t lfht_fetch_add_key(
+		struct lfht_head *lfht,
+		const void *key,
+		size_t len,
+		size_t delta,
+		int thread_id)
 {
-	_Atomic(struct lfht_node *) *prev =
-		&(hnode->hash.prev);
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->inserts++;
+#endif
+	struct lfht_key k = {key, len};
+	return search_fetch_add(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			lfht->key_hash(key, len),
+			&k,
+			delta);
+}
 
-	struct lfht_node *parent = atomic_load_explicit(
-			prev,
-			memory_order_consume);
+void lfht_remove_key(
+		struct lfht_head *lfht,
+		const void *key,
+		size_t len,
+		int thread_id)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->api_calls++;
+	stats->removes++;
+#endif
+	struct lfht_key k = {key, len};
+	search_remove(
+			lfht,
+			thread_id,
+			lfht->entry_hash,
+			lfht->key_hash(key, len),
+			&k);
+}
+
+// FNV-1a
+size_t lfht_hash_bytes(
+		const void *key,
+		size_t len)
+{
+	const unsigned char *bytes = key;
+	size_t hash = 14695981039346656037ULL;
+
+	for(size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
 
-	return !parent;
+	return hash;
 }
 
-unsigned is_compression_node(struct lfht_node *node)
+int lfht_eq_bytes(
+		const void *k1,
+		size_t len1,
+		const void *k2,
+		size_t len2)
 {
-	return node->type == FREEZE || node->type == UNFREEZE;
+	return len1 == len2 && !memcmp(k1, k2, len1);
 }
 
-unsigned is_empty(struct lfht_node *hnode)
+// memory pool functions
+
+struct lfht_pool *create_pool()
 {
-	for(int i = 0; i < (1<<hnode->hash.size); i++) {
-		struct lfht_node *head;
-		_Atomic(struct lfht_node *) *nxt_atomic_bucket =
-			&(hnode->hash.array[i]);
+	size_t alloc_size = CACHE_SIZE * ((sizeof(struct lfht_pool) / CACHE_SIZE) + 1);
+	struct lfht_pool *pool = aligned_alloc(CACHE_SIZE, alloc_size);
+
+	for(int i = 0; i < POOL_CLASSES; i++) {
+		atomic_init(&(pool->remote[i]), NULL);
+		pool->free_list[i] = NULL;
+		pool->bump[i] = NULL;
+		pool->end[i] = NULL;
+	}
+	pool->slabs = NULL;
 
-		head = atomic_load_explicit(
-				nxt_atomic_bucket,
-				memory_order_consume);
+	return pool;
+}
 
-		if(head != hnode) {
-			// bucket not empty
-			return 0;
-		}
+// not thread safe
+// releases every node carved from the pool
+void free_pool(struct lfht_pool *pool)
+{
+	struct lfht_slab *slab = pool->slabs;
+	while(slab) {
+		struct lfht_slab *nxt = slab->next;
+#if LFHT_REFS
+		ref_release(slab);
+#endif
+		free(slab);
+		slab = nxt;
 	}
+	free(pool);
+}
 
-	return 1;
+size_t pool_class_size(int size_class)
+{
+	size_t size;
+
+	switch(size_class) {
+	case LEAF_CLASS:
+		size = offsetof(struct lfht_node, leaf.key);
+		break;
+	case FREEZE_CLASS:
+		size = offsetof(struct lfht_node, leaf.value) + sizeof(void *);
+		break;
+	case KEY_LEAF_CLASS:
+		size = sizeof(struct lfht_node);
+		break;
+	default:
+		size = hash_node_size(size_class - HASH_CLASS);
+	}
+
+	return (size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
 }
 
-// retries CAS until it succeeds
-int force_cas(struct lfht_node *node, struct lfht_node *replace)
+// size -> log2 of the number of buckets
+size_t hash_node_size(int size)
 {
-	struct lfht_node *expect = get_next(node);
+	size_t node_size = offsetof(struct lfht_node, hash.array) +
+		(1<<size) * sizeof(lfht_ref);
+#if LFHT_FILTERS
+	// one filter word per bucket (see get_filter())
+	node_size = (node_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	node_size += (1<<size) * sizeof(uint64_t);
+#endif
+	return node_size;
+}
 
-	if(is_invalid(expect)) {
+// bytes node takes in its pool, as map_memory() counts them
+size_t node_size(
+		struct lfht_head *lfht,
+		struct lfht_node *node)
+{
+	switch(node->type) {
+	case HASH:
+		return pool_class_size(HASH_CLASS + node->hash.size);
+	case LEAF:
+		return pool_class_size(lfht->key_eq ? KEY_LEAF_CLASS : LEAF_CLASS);
+	default:
+		return pool_class_size(FREEZE_CLASS);
+	}
+}
+
+struct lfht_slab *slab_of(void *node)
+{
+	return (struct lfht_slab *) ((uintptr_t) node & ~(uintptr_t)(POOL_SLAB_SIZE - 1));
+}
+
+#if LFHT_REFS
+// node handles
+//
+// a handle is the id of the slab of the node, the offset of the node
+// in the slab in POOL_ALIGN units (REF_OFFSET_BITS, the log2 of
+// POOL_SLAB_SIZE / POOL_ALIGN) and the invalid mark in bit 0.
+// id 0 stands for NULL.
+// ids of released slabs are reused, the process may hold up to
+// REF_MAX_SLABS slabs at once (32GB of pools and wide nodes, 16GB
+// with LFHT_COMPACT_LEAVES).
+#if LFHT_COMPACT_LEAVES
+#define REF_OFFSET_BITS 13
+#else
+#define REF_OFFSET_BITS 12
+#endif
+#define REF_MAX_SLABS (1 << (31 - REF_OFFSET_BITS))
+
+static _Atomic(struct lfht_slab *) ref_slabs[REF_MAX_SLABS];
+// slabs come and go rarely, so ids are handed out under a lock
+static pthread_mutex_t ref_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int ref_slab_count = 1;
+static unsigned int ref_free_ids[REF_MAX_SLABS];
+static unsigned int ref_free_count = 0;
+
+// nodes are created where no error can be returned, so running out
+// of ids aborts, as running out of memory does
+void ref_register(struct lfht_slab *slab)
+{
+	unsigned int id = 0;
+
+	pthread_mutex_lock(&ref_lock);
+	if(ref_free_count > 0) {
+		id = ref_free_ids[--ref_free_count];
+	} else if(ref_slab_count < REF_MAX_SLABS) {
+		id = ref_slab_count++;
+	}
+	pthread_mutex_unlock(&ref_lock);
+
+	if(!id) {
+		// out of handles
+		abort();
+	}
+
+	slab->id = id;
+	atomic_store_explicit(&(ref_slabs[id]), slab, memory_order_release);
+}
+
+// slab is about to be freed, none of its nodes is reachable
+void ref_release(struct lfht_slab *slab)
+{
+	atomic_store_explicit(&(ref_slabs[slab->id]), NULL, memory_order_relaxed);
+
+	pthread_mutex_lock(&ref_lock);
+	ref_free_ids[ref_free_count++] = slab->id;
+	pthread_mutex_unlock(&ref_lock);
+}
+#endif
+
+// keeps the invalid mark of node
+lfht_ref to_ref(struct lfht_node *node)
+{
+#if LFHT_REFS
+	uintptr_t mark = (uintptr_t) node & 1;
+	char *ptr = (char *) ((uintptr_t) node & ~(uintptr_t) 1);
+
+	if(!ptr) {
 		return 0;
 	}
 
-	if(expect == replace) {
-		// value already in place
+	struct lfht_slab *slab = slab_of(ptr);
+	uintptr_t offset = (ptr - (char *) slab) / POOL_ALIGN;
+
+	return (slab->id << (REF_OFFSET_BITS + 1)) | (offset << 1) | mark;
+#else
+	return node;
+#endif
+}
+
+struct lfht_node *from_ref(lfht_ref ref)
+{
+#if LFHT_REFS
+	if(!ref) {
+		return NULL;
+	}
+
+	// a slab is registered before any of its nodes is published
+	struct lfht_slab *slab = atomic_load_explicit(
+			&(ref_slabs[ref >> (REF_OFFSET_BITS + 1)]),
+			memory_order_relaxed);
+	uintptr_t offset = (ref >> 1) & ((1 << REF_OFFSET_BITS) - 1);
+
+	return (struct lfht_node *)
+		((uintptr_t) ((char *) slab + offset * POOL_ALIGN) | (ref & 1));
+#else
+	return ref;
+#endif
+}
+
+struct lfht_node *ref_load(
+		_Atomic(lfht_ref) *ref,
+		memory_order order)
+{
+	return from_ref(atomic_load_explicit(ref, order));
+}
+
+void ref_init(
+		_Atomic(lfht_ref) *ref,
+		struct lfht_node *node)
+{
+	atomic_init(ref, to_ref(node));
+}
+
+void ref_store(
+		_Atomic(lfht_ref) *ref,
+		struct lfht_node *node,
+		memory_order order)
+{
+	atomic_store_explicit(ref, to_ref(node), order);
+}
+
+// on failure expected is updated with the node found
+int ref_cas(
+		_Atomic(lfht_ref) *ref,
+		struct lfht_node **expected,
+		struct lfht_node *desired,
+		memory_order success,
+		memory_order failure)
+{
+	lfht_ref old = to_ref(*expected);
+
+	if(atomic_compare_exchange_strong_explicit(
+				ref,
+				&old,
+				to_ref(desired),
+				success,
+				failure)) {
 		return 1;
 	}
 
-	while(!atomic_compare_exchange_weak_explicit(
-				&(node->leaf.next),
-				&expect,
-				replace,
-				memory_order_acq_rel,
-				memory_order_consume)) {
-		if(is_invalid(expect)) {
-			return 0;
-		}
+	*expected = from_ref(old);
+	return 0;
+}
+
+// nodes too big to share a slab get one of their own
+void *standalone_alloc(size_t size)
+{
+	size_t alloc_size = SLAB_HEADER_SIZE + size;
+	alloc_size = POOL_SLAB_SIZE * ((alloc_size + POOL_SLAB_SIZE - 1) / POOL_SLAB_SIZE);
+
+	struct lfht_slab *slab = aligned_alloc(POOL_SLAB_SIZE, alloc_size);
+	if(!slab) {
+		// no caller could undo the update that needed the node
+		abort();
 	}
-	return 1;
+	slab->owner = NULL;
+	slab->next = NULL;
+	slab->size_class = -1;
+#if LFHT_REFS
+	ref_register(slab);
+#endif
+
+	return (char *) slab + SLAB_HEADER_SIZE;
 }
 
-// hnode -> parent hash node of lnode
-// lnode -> will point to the target node, if it exists
-//
-// for use w/ insertion():
-//   tail -> tail of the chain
-//   count -> length of the collision chain
-//
-// returns: 0/1 success
-int lookup(
+// roots of lean tables share a pool rather than taking a slab each
+void *lean_alloc(int size_class)
+{
+	pthread_mutex_lock(&lean_lock);
+	if(!lean_roots) {
+		lean_roots = create_pool();
+	}
+
+	void *node = pool_take(lean_roots, size_class);
+	if(!node) {
+		node = pool_carve(lean_roots, size_class);
+	}
+	pthread_mutex_unlock(&lean_lock);
+
+	return node;
+}
+
+void *node_alloc(
 		struct lfht_head *lfht,
 		int thread_id,
-		size_t hash,
-		struct lfht_node **hnode,
-		struct lfht_node **lnode,
-		_Atomic(struct lfht_node *) **tail,
-		unsigned int *count)
+		int size_class)
 {
 #if LFHT_STATS
 	struct lfht_stats* stats = lfht->stats[thread_id];
-	stats->lookups++;
-	stats->operations++;
 #endif
+	struct lfht_pool *pool = lfht->pools[thread_id];
 
-	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	if(!pool) {
+		// thread was never initialized
+		pool = create_pool();
+		lfht->pools[thread_id] = pool;
+	}
 
-start: ;
-	// HP.protect uses a ring buffer to protect references
-	// the following protection prevents the *hnode reference from
-	// getting overwritten from its HP after a few retrials
-	if (*hnode != lfht->entry_hash) {
-		hp_protect(dom, hp, *hnode);
+	void *node = pool_take(pool, size_class);
+
+	if(node) {
+#if LFHT_STATS
+		stats->pool_hits++;
+#endif
+		return node;
 	}
 
 #if LFHT_STATS
-	stats->max_retry_counter++;
+	stats->pool_misses++;
 #endif
 
-traversal: ;
+	return pool_carve(pool, size_class);
+}
 
-	// load bucket entry
+// owner thread only
+//
+// returns: a node freed to pool, NULL if there is none
+void *pool_take(
+		struct lfht_pool *pool,
+		int size_class)
+{
+	struct lfht_free_node *node = pool->free_list[size_class];
+
+	if(!node) {
+		// take back nodes freed by other threads
+		node = atomic_exchange_explicit(
+				&(pool->remote[size_class]),
+				NULL,
+				memory_order_acquire);
+	}
 
-	_Atomic(struct lfht_node *) *bucket =
-		get_atomic_bucket(hash, *hnode);
+	if(node) {
+		pool->free_list[size_class] = node->next;
+	}
 
-	_Atomic(struct lfht_node *) *prev = bucket;
+	return node;
+}
 
-	struct lfht_node *iter = atomic_load_explicit(
-			prev,
-			memory_order_consume);
+// owner thread only
+void *pool_carve(
+		struct lfht_pool *pool,
+		int size_class)
+{
+	size_t size = pool_class_size(size_class);
+
+	if(!pool->bump[size_class] ||
+			(size_t) (pool->end[size_class] - pool->bump[size_class]) < size) {
+		// slab exhausted
+		struct lfht_slab *slab = aligned_alloc(POOL_SLAB_SIZE, POOL_SLAB_SIZE);
+		if(!slab) {
+			// as in standalone_alloc()
+			abort();
+		}
+#if LFHT_REFS
+		ref_register(slab);
+#endif
+		slab->owner = pool;
+		slab->size_class = size_class;
+		slab->next = pool->slabs;
+		pool->slabs = slab;
 
-	hp_protect(dom, hp, iter);
-	// is hazard pointer safe?
-	if(iter != atomic_load_explicit(
-				prev,
-				memory_order_consume)) {
-		// hazard pointer unprotected, retry
-		goto start;
+		pool->bump[size_class] = (char *) slab + SLAB_HEADER_SIZE;
+		pool->end[size_class] = (char *) slab + POOL_SLAB_SIZE;
 	}
 
-	struct lfht_node *head = iter;
-	*lnode = head;
+	void *res = pool->bump[size_class];
+	pool->bump[size_class] += size;
+	return res;
+}
+
+// may be called by any thread
+// thread_id -> caller, or -1 if unknown
+void node_free(
+		struct lfht_head *lfht,
+		int thread_id,
+		void *ptr)
+{
+	struct lfht_slab *slab = slab_of(ptr);
+	struct lfht_pool *owner = slab->owner;
+
+	if(!owner) {
+#if LFHT_REFS
+		ref_release(slab);
+#endif
+		free(slab);
+		return;
+	}
+
+	struct lfht_free_node *node = ptr;
+	int size_class = slab->size_class;
+	int known = thread_id >= 0 && thread_id < lfht->max_threads;
+
+	if(known && lfht->pools[thread_id] == owner) {
+		node->next = owner->free_list[size_class];
+		owner->free_list[size_class] = node;
+		return;
+	}
+
+#if LFHT_STATS
+	if(known && lfht->stats[thread_id]) {
+		lfht->stats[thread_id]->pool_remote_frees++;
+	}
+#endif
+
+	// hand node back to its owner
+	_Atomic(struct lfht_free_node *) *remote = &(owner->remote[size_class]);
+	struct lfht_free_node *head = atomic_load_explicit(
+			remote,
+			memory_order_relaxed);
+
+	do {
+		node->next = head;
+	} while(!atomic_compare_exchange_weak_explicit(
+				remote,
+				&head,
+				node,
+				memory_order_release,
+				memory_order_relaxed));
+}
+
+// hazard pointer reclamation callback
+void reclaim_node(
+		void *lfht,
+		int thread_id,
+		void *node)
+{
+	node_free(lfht, thread_id, node);
+}
+
+// lean tables
+
+// the first lean table sets up a table of its own, never used but for
+// its per thread arrays and its domain, whose reclaimed nodes go back
+// to the pools through it. the arrays are shared by every lean table
+// from then on, so the per thread state costs nothing more per table
+// and nodes are shared out of the same slabs
+struct lfht_head *lean_share(
+		int max_threads,
+		struct lfht_config *config)
+{
+	struct lfht_config shared;
+	lfht_default_config(&shared);
+	shared.root_hash_size = 0;
+	shared.max_chain_nodes = config->max_chain_nodes;
+	// for the lean tables that merge levels
+	shared.merge_levels = 1;
+
+	return init_lfht_config(max_threads, &shared);
+}
+
+// not thread safe
+// frees the leaves and levels below hnode, but not hnode, giving
+// them back to the pools they came from. a merge that stopped
+// halfway leaves its target behind several buckets of the level,
+// where it is freed once. compression nodes are left, as they may
+// have been retired already
+void free_level(
+		struct lfht_head *lfht,
+		struct lfht_node *hnode)
+{
+	struct lfht_node *target = NULL;
+
+	for(int i = 0; i < 1<<hnode->hash.size; i++) {
+		struct lfht_node *node = from_ref(hnode->hash.array[i]);
+
+		while(node != hnode) {
+			if(node->type == HASH) {
+				if(hnode->hash.size > 0 && is_merge_target(hnode, node)) {
+					target = node;
+				} else if(!is_root(node)) {
+					free_level(lfht, node);
+					node_free(lfht, -1, node);
+				}
+				break;
+			}
+
+			struct lfht_node *nxt = valid_ptr(get_next(node));
+			if(node->type == LEAF) {
+				node_free(lfht, -1, node);
+			}
+			node = nxt;
+		}
+	}
+
+	if(target) {
+		free_level(lfht, target);
+		node_free(lfht, -1, target);
+	}
+}
+
+// not thread safe
+// roots are not retired as they grow, the first bucket of each one
+// points to the next
+void free_roots(struct lfht_head *lfht)
+{
+	struct lfht_node *root = lfht->base_hash;
+	while(root != lfht->entry_hash) {
+		struct lfht_node *next = from_ref(root->hash.array[0]);
+		node_free(lfht, -1, root);
+		root = next;
+	}
+	node_free(lfht, -1, root);
+}
+
+// auxiliary functions
+
+struct lfht_node *create_freeze_node(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *next)
+{
+	struct lfht_node *node = node_alloc(lfht, thread_id, FREEZE_CLASS);
+	node->type = FREEZE;
+
+	ref_init(&(node->leaf.next), next);
+	atomic_init(&(node->leaf.value), NULL);
+
+	return node;
+}
+
+struct lfht_node *create_unfreeze_node(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *next)
+{
+	struct lfht_node *node = node_alloc(lfht, thread_id, FREEZE_CLASS);
+	node->type = UNFREEZE;
+
+	ref_init(&(node->leaf.next), next);
+	atomic_init(&(node->leaf.value), NULL);
+
+	return node;
+}
+
+struct lfht_node *create_leaf_node(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash,
+		const struct lfht_key *key,
+		void *value,
+		struct lfht_node *next)
+{
+	struct lfht_node *node;
+
+	if(lfht->key_eq) {
+		node = node_alloc(lfht, thread_id, KEY_LEAF_CLASS);
+		node->leaf.key = key ? key->ptr : NULL;
+		node->leaf.key_len = key ? key->len : 0;
+	} else {
+		node = node_alloc(lfht, thread_id, LEAF_CLASS);
+	}
+
+	node->type = LEAF;
+#if LFHT_COMPACT_LEAVES
+	node->hash_high = hash >> LEAF_IMPLIED_BITS;
+#else
+	node->leaf.hash = hash;
+#endif
+	node->leaf.value = value;
+
+	ref_init(&(node->leaf.next), next);
+
+	return node;
+}
+
+// thread_id -> -1 for nodes outside of any pool
+struct lfht_node *create_hash_node(
+		struct lfht_head *lfht,
+		int thread_id,
+		int size,
+		int hash_pos,
+		struct lfht_node *prev)
+{
+	struct lfht_node *node;
+
+	if(lfht->lean && thread_id < 0 && size <= POOL_MAX_HASH_SIZE) {
+		node = lean_alloc(HASH_CLASS + size);
+	} else if(thread_id < 0 || size > POOL_MAX_HASH_SIZE) {
+		node = standalone_alloc(hash_node_size(size));
+	} else {
+		node = node_alloc(lfht, thread_id, HASH_CLASS + size);
+	}
+
+	node->type = HASH;
+	node->hash.size = size;
+	node->hash.reversed = prev ? !prev->hash.reversed : 0;
+	node->hash.root = 0;
+	node->hash.hash_pos = hash_pos;
+	atomic_init(&(node->hash.occupied), 0);
+	atomic_init(&(node->hash.idle), 0);
+	ref_init(&(node->hash.prev), prev);
+	for(int i=0; i < 1<<size; i++) {
+		ref_init(&(node->hash.array[i]), node);
+	}
+#if LFHT_FILTERS
+	_Atomic(uint64_t) *filters = get_filter(0, node);
+	for(int i=0; i < 1<<size; i++) {
+		atomic_init(&(filters[i]), 0);
+	}
+#endif
+	return node;
+}
+
+// for the current hash level, return the chunk of the
+// hash which indexes the bucket array (of size 2^w)
+int get_bucket_index(
+		size_t hash,
+		int hash_pos,
+		int size)
+{
+	// hash_pos does not increment 1 by 1
+	// it increments with the chunk size
+	return (hash >> hash_pos) & ((1 << size) - 1);
+}
+
+// width of a new level below hnode for a chain of count leaves
+// whose hashes differ in the bits of diff
+// the level skips the bits every leaf shares, so that they do not
+// end up in the only bucket in use of a narrow level, and grows
+// with the population, from min_hash_size up to max_hash_size
+int expansion_size(
+		struct lfht_head *lfht,
+		struct lfht_node *hnode,
+		size_t diff,
+		size_t count)
+{
+	int hash_pos = hnode->hash.hash_pos + hnode->hash.size;
+	int left = 8 * sizeof(size_t) - hash_pos;
+	int size = lfht->min_hash_size;
+
+	while(size < lfht->max_hash_size && ((size_t) 1 << size) < count) {
+		size++;
+	}
+
+	diff >>= hash_pos;
+	size += diff ? __builtin_ctzl(diff) : left;
+
+	if(size > lfht->max_hash_size) {
+		size = lfht->max_hash_size;
+	}
+	return size < left ? size : left;
+}
+
+_Atomic(lfht_ref) *get_atomic_bucket(
+		size_t hash,
+		struct lfht_node *hnode)
+{
+	int pos = get_bucket_index(
+			hash,
+			hnode->hash.hash_pos,
+			hnode->hash.size);
+
+	return &(hnode->hash.array[pos]);
+}
+
+#if LFHT_FILTERS
+// bucket filters
+//
+// the filter of a bucket has the bit of every valid leaf of its chain
+// (filter_bit()), so a lookup that finds the bit clear reports a miss
+// without walking the chain. FILTER_EXPANDED is set while a level may
+// hang from the tail of the chain, which then has to be walked.
+//
+// bits are set by filter_begin() before a leaf or level is linked to
+// the chain, and filter_end() follows the link CAS. lookups that walk
+// the whole chain clear the bits of leaves that left it, as long as
+// no link was pending when they loaded the filter and none started
+// since (filter_update()).
+//
+// FILTER_BITS bits of leaves, FILTER_EXPANDED, then the count of
+// pending links (up to 511) and a version bumped by filter_begin(),
+// 42 bits wide so that it cannot wrap around while a lookup holds an
+// old filter, whose CAS would then clear the bit of a new leaf
+#define FILTER_BITS 12
+#define FILTER_EXPANDED ((uint64_t) 1 << FILTER_BITS)
+#define FILTER_MARKS ((FILTER_EXPANDED << 1) - 1)
+#define FILTER_PENDING (FILTER_EXPANDED << 1)
+#define FILTER_VERSION (FILTER_PENDING << 9)
+#define FILTER_PENDING_MASK (FILTER_VERSION - FILTER_PENDING)
+
+_Atomic(uint64_t) *get_filter(
+		size_t hash,
+		struct lfht_node *hnode)
+{
+	// after the buckets, aligned as in hash_node_size()
+	uintptr_t end = (uintptr_t) &(hnode->hash.array[1 << hnode->hash.size]);
+	_Atomic(uint64_t) *filters = (_Atomic(uint64_t) *)
+		((end + sizeof(uint64_t) - 1) & ~(uintptr_t) (sizeof(uint64_t) - 1));
+
+	return &(filters[get_bucket_index(
+				hash,
+				hnode->hash.hash_pos,
+				hnode->hash.size)]);
+}
+
+// picked from the bits of hash above the bucket, as the leaves of a
+// bucket share the others (and compact leaves lack the lowest ones)
+uint64_t filter_bit(
+		size_t hash,
+		struct lfht_node *hnode)
+{
+	int pos = hnode->hash.hash_pos + hnode->hash.size;
+	size_t rest = pos < (int) (8 * sizeof(size_t)) ? hash >> pos : 0;
+
+	return (uint64_t) 1 << ((rest * 0xff51afd7ed558ccdUL) >> 58) % FILTER_BITS;
+}
+
+void filter_begin(
+		size_t hash,
+		struct lfht_node *hnode,
+		uint64_t bits)
+{
+	_Atomic(uint64_t) *filter = get_filter(hash, hnode);
+	uint64_t old = atomic_load_explicit(filter, memory_order_relaxed);
+
+	while(!atomic_compare_exchange_weak_explicit(
+				filter,
+				&old,
+				(old | bits) + FILTER_PENDING + FILTER_VERSION,
+				memory_order_seq_cst,
+				memory_order_relaxed));
+}
+
+void filter_end(
+		size_t hash,
+		struct lfht_node *hnode)
+{
+	atomic_fetch_sub_explicit(
+			get_filter(hash, hnode),
+			FILTER_PENDING,
+			memory_order_seq_cst);
+}
+
+// filter -> loaded before the walk of the chain
+// seen -> bits of the valid leaves walked
+void filter_update(
+		size_t hash,
+		struct lfht_node *hnode,
+		uint64_t filter,
+		uint64_t seen)
+{
+	if(filter & FILTER_PENDING_MASK || (filter & FILTER_MARKS) == seen) {
+		return;
+	}
+
+	atomic_compare_exchange_strong_explicit(
+			get_filter(hash, hnode),
+			&filter,
+			(filter & ~FILTER_MARKS) | seen,
+			memory_order_seq_cst,
+			memory_order_relaxed);
+}
+#endif
+
+#if LFHT_JUMP_CACHE
+// jump cache
+//
+// a cached hash node may have been compressed and reclaimed since.
+// compress() clears hash.prev, commits, and only then bumps
+// jump_epoch and retires the node, so a node protected before
+// jump_epoch is found unchanged since the entry was made cannot
+// have been retired, and the check of hash.prev (see jump_put())
+// rules out the compressions that were already committed.
+
+struct lfht_jump *jump_entry(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash)
+{
+	size_t prefix = lfht->jump_bits < (int) (8 * sizeof(size_t)) ?
+		hash & (((size_t) 1 << lfht->jump_bits) - 1) : hash;
+
+	return &(lfht->jumps[thread_id][
+			((prefix * 0xff51afd7ed558ccdUL) >> 32) % JUMP_SLOTS]);
+}
+
+// returns: 1 if hash shares the hash_pos lowest bits of the entry
+unsigned jump_covers(
+		struct lfht_jump *entry,
+		size_t hash,
+		int hash_pos)
+{
+	size_t mask = hash_pos < (int) (8 * sizeof(size_t)) ?
+		((size_t) 1 << hash_pos) - 1 : ~(size_t) 0;
+
+	return !((hash ^ entry->prefix) & mask);
+}
+
+// returns: protected hash node to start the lookup of hash from,
+// the root if none is cached
+struct lfht_node *jump_get(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash)
+{
+	if(!lfht->jumps) {
+		// lean table
+		return lfht->entry_hash;
+	}
+
+	struct lfht_jump *entry = jump_entry(lfht, thread_id, hash);
+	struct lfht_node *hnode = NULL;
+
+	if(entry->deep && jump_covers(entry, hash, entry->deep_pos)) {
+		hnode = entry->deep;
+	} else if(entry->anchor && jump_covers(entry, hash, lfht->jump_bits)) {
+		hnode = entry->anchor;
+	}
+
+	if(!hnode ||
+			entry->epoch != atomic_load_explicit(
+				&(lfht->jump_epoch),
+				memory_order_relaxed)) {
+		return lfht->entry_hash;
+	}
+
+	hp_protect(lfht->dom, lfht->hazard_pointers[thread_id], hnode);
+	if(entry->epoch != atomic_load_explicit(
+				&(lfht->jump_epoch),
+				memory_order_seq_cst) ||
+			is_compressed(hnode)) {
+		return lfht->entry_hash;
+	}
+
+	return hnode;
+}
+
+// hnode -> protected hash node on the path of hash, below the root
+void jump_put(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash,
+		struct lfht_node *hnode)
+{
+	if(!lfht->jumps) {
+		return;
+	}
+
+	struct lfht_jump *entry = jump_entry(lfht, thread_id, hash);
+	unsigned long epoch = atomic_load_explicit(
+			&(lfht->jump_epoch),
+			memory_order_seq_cst);
+
+	if(is_compressed(hnode)) {
+		return;
+	}
+
+	if(entry->epoch != epoch || !jump_covers(entry, hash, lfht->jump_bits)) {
+		entry->anchor = NULL;
+		entry->epoch = epoch;
+	}
+
+	if(hnode->hash.hash_pos <= lfht->jump_bits) {
+		entry->anchor = hnode;
+	}
+	entry->deep = hnode;
+	entry->deep_pos = hnode->hash.hash_pos;
+	entry->prefix = hash;
+}
+#endif
+
+// directory
+//
+// the entry of a prefix points to the deepest level known to be on
+// the path of every hash with that prefix, i.e. at most dir_bits
+// down. help_expansion() sets the entries of new levels, lookup()
+// the ones it finds behind, and the commit of compress() moves them
+// back to the parent before the level is retired, so the usual
+// protect and reload of the entry is enough to use it.
+// a level compressed while another thread was setting it is put
+// back to the root by that thread (see dir_set()).
+
+_Atomic(lfht_ref) *dir_entry(
+		struct lfht_head *lfht,
+		size_t hash)
+{
+	return &(lfht->dir[hash & (((size_t) 1 << lfht->dir_bits) - 1)]);
+}
+
+// returns: protected hash node to start the lookup of hash from
+struct lfht_node *dir_get(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash)
+{
+	_Atomic(lfht_ref) *entry = dir_entry(lfht, hash);
+	struct lfht_node *hnode = ref_load(
+			entry,
+			memory_order_consume);
+
+	if(hnode == lfht->entry_hash) {
+		return hnode;
+	}
+
+	hp_protect(lfht->dom, lfht->hazard_pointers[thread_id], hnode);
+	if(hnode != ref_load(
+				entry,
+				memory_order_seq_cst) ||
+			is_compressed(hnode)) {
+		return lfht->entry_hash;
+	}
+
+	return hnode;
+}
+
+// moves the entry of hash from expect to the protected hnode,
+// unless it was changed meanwhile
+void dir_set(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash,
+		struct lfht_node *expect,
+		struct lfht_node *hnode)
+{
+	_Atomic(lfht_ref) *entry = dir_entry(lfht, hash);
+
+	if(!ref_cas(
+				entry,
+				&expect,
+				hnode,
+				memory_order_acq_rel,
+				memory_order_relaxed)) {
+		return;
+	}
+#if LFHT_STATS
+	lfht->stats[thread_id]->dir_updates++;
+#endif
+
+	// compressed before the entry was set, its compress() may
+	// have missed it
+	if(hnode != lfht->entry_hash && is_compressed(hnode)) {
+		expect = hnode;
+		ref_cas(
+				entry,
+				&expect,
+				lfht->entry_hash,
+				memory_order_acq_rel,
+				memory_order_relaxed);
+	}
+}
+
+// dir_set() on the entries of every prefix that leads to the deeper
+// of expect and hnode, a new level or a compressed one
+void dir_replace(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash,
+		struct lfht_node *expect,
+		struct lfht_node *hnode)
+{
+	int pos = expect->hash.hash_pos > hnode->hash.hash_pos ?
+		expect->hash.hash_pos : hnode->hash.hash_pos;
+
+	if(pos > lfht->dir_bits) {
+		return;
+	}
+
+	size_t prefix = hash & (((size_t) 1 << pos) - 1);
+	for(size_t i = 0; i < (size_t) 1 << (lfht->dir_bits - pos); i++) {
+		dir_set(lfht, thread_id, prefix | (i << pos), expect, hnode);
+	}
+}
+
+// release-consume order get next
+struct lfht_node *get_next(
+		struct lfht_node *node)
+{
+	//return atomic_load_explicit(
+	//		&(node->leaf.next),
+	//		memory_order_consume);
+
+	// avoiding hazards during compress operation WIP
+	struct lfht_node* nxt = ref_load(
+			&(node->leaf.next),
+			memory_order_seq_cst);
+
+	return nxt;
+}
+
+struct lfht_node *get_prev(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode)
+{
+	struct lfht_node* prev = ref_load(
+			&(hnode->hash.prev),
+			memory_order_seq_cst);
+
+	if(!prev) {
+		return lfht->entry_hash;
+	}
+
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	hp_protect(lfht->dom, hp, prev);
+	if(prev != ref_load(
+			&(hnode->hash.prev),
+			memory_order_seq_cst)) {
+		// hazard pointer not safe
+		return lfht->entry_hash;
+	}
+
+	// prev protected successfully
+	return prev;
+}
+
+// we do not use an "is_valid" field.
+// to verify if a node is valid, the least significant bit
+// of the *next field is used (the address, not the node it
+// points to).
+//
+// validating a node using the mask ~1:
+// 0xFFFF & ~1 === 0xFFFF & 0xFFFE = 0xFFFE
+//
+// invalidating a node:
+// 0xFFFE | 1 === 0xFFFE | 0x0001 = 0xFFFF
+//
+// arg: the *next address of the node we want to invalidate
+// return: pointer masked with "valid"
+struct lfht_node *valid_ptr(struct lfht_node *next)
+{
+	return (struct lfht_node *) ((uintptr_t) next & ~1);
+}
+
+struct lfht_node *invalid_ptr(struct lfht_node *next)
+{
+	return (struct lfht_node *) ((uintptr_t) next | 1);
+}
+
+// mask address to get the valid/invalid bit flag
+// 
+// arg: the *next address of the node
+// return: the least significant bit of *next
+unsigned is_invalid(struct lfht_node *ptr)
+{
+	return (uintptr_t) ptr & 1;
+}
+
+unsigned is_compressed(struct lfht_node *hnode)
+{
+	_Atomic(lfht_ref) *prev =
+		&(hnode->hash.prev);
+
+	struct lfht_node *parent = ref_load(
+			prev,
+			memory_order_seq_cst);
+
+	// roots have no parent either
+	return !parent && !is_root(hnode);
+}
+
+// the current root and the ones it grew from (see grow_root()). the
+// levels below a root of 0 bits start at bit 0 as well, so roots are
+// marked when they are created
+unsigned is_root(struct lfht_node *hnode)
+{
+	return hnode->hash.root;
+}
+
+unsigned is_compression_node(struct lfht_node *node)
+{
+	return node->type == FREEZE || node->type == UNFREEZE;
+}
+
+// a leaf of the chain of owner that points to another level is the
+// last one of a chain being moved there (see adjust_node()), so it may
+// be in the chain of that level too, where it is detached once invalid
+//
+// nxt -> next of the leaf, invalid or not
+unsigned moved_on(
+		struct lfht_node *owner,
+		struct lfht_node *nxt)
+{
+	nxt = valid_ptr(nxt);
+	return nxt != owner && nxt->type == HASH;
+}
+
+// returns: 1 if target is the single bucket level that takes the
+// leaves of hnode in a merge, not an expansion (see merge())
+unsigned is_merge_target(
+		struct lfht_node *hnode,
+		struct lfht_node *target)
+{
+	return target->hash.size == 0 &&
+		target->hash.hash_pos <= hnode->hash.hash_pos;
+}
+
+// occupied is counted up after a bucket gets its first node and down
+// after its last one leaves, so it may lag behind the buckets, even
+// below 0, while a link or unlink is about to be counted. that is
+// left to compress(), whose freeze of every bucket fails on the ones
+// that are not empty, while the thread that empties the last bucket
+// always finds its count at 0 and compresses.
+unsigned is_empty(struct lfht_node *hnode)
+{
+	return atomic_load_explicit(
+			&(hnode->hash.occupied),
+			memory_order_seq_cst) <= 0;
+}
+
+// returns: the count before delta
+int count_bucket(
+		struct lfht_node *hnode,
+		int delta)
+{
+	return atomic_fetch_add_explicit(
+			&(hnode->hash.occupied),
+			delta,
+			memory_order_seq_cst);
+}
+
+// with compress_delay, a level left empty is only compressed after
+// that many lookups missed on it, keys inserted and removed around
+// an expansion find the level still there instead of compressing
+// and expanding it again. levels no lookup reaches stay expanded
+void defer_compress(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode)
+{
+	atomic_store_explicit(
+			&(hnode->hash.idle),
+			lfht->compress_delay,
+			memory_order_relaxed);
+#if LFHT_STATS
+	lfht->stats[thread_id]->deferred_compression_counter++;
+#endif
+}
+
+// counts a miss on the empty level hnode
+//
+// returns: 1 for the miss that ends its idle age
+unsigned is_idle_over(struct lfht_node *hnode)
+{
+	return atomic_load_explicit(
+			&(hnode->hash.idle),
+			memory_order_relaxed) > 0 &&
+		atomic_fetch_sub_explicit(
+			&(hnode->hash.idle),
+			1,
+			memory_order_relaxed) == 1;
+}
+
+// the empty level hnode got a key before its compression
+void reuse_level(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode)
+{
+	if(atomic_exchange_explicit(
+				&(hnode->hash.idle),
+				0,
+				memory_order_relaxed) > 0) {
+#if LFHT_STATS
+		lfht->stats[thread_id]->avoided_compression_counter++;
+#else
+		(void) lfht;
+		(void) thread_id;
+#endif
+	}
+}
+
+unsigned is_removed(struct lfht_node *node)
+{
+	return node->type == LEAF && atomic_load_explicit(
+			&(node->leaf.value),
+			memory_order_consume) == REMOVED;
+}
+
+// marks cnode invalid, nxt_ptr holds its expected next node
+// on success nxt_ptr is updated with the marked next pointer
+//
+// returns: 0 if the caller must restart
+int mark_invalid(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		struct lfht_node *cnode,
+		struct lfht_node **nxt_ptr,
+		size_t hash)
+{
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	struct lfht_node *nxt = *nxt_ptr;
+
+	hp_protect(lfht->dom, hp, nxt);
+	if(nxt != get_next(cnode)) {
+		return 0;
+	}
+
+	if(nxt->type == HASH && nxt != hnode) {
+		// expansion detected
+		help_expansion(
+				lfht,
+				thread_id,
+				hnode,
+				nxt,
+				hash);
+
+		return 0;
+	}
+
+	if(!ref_cas(
+				&(cnode->leaf.next),
+				&nxt,
+				invalid_ptr(nxt),
+				memory_order_acq_rel,
+				memory_order_consume)
+			&& !is_invalid(nxt)) {
+		// new node inserted in front of cnode
+		return 0;
+	}
+
+	*nxt_ptr = invalid_ptr(nxt);
+	return 1;
+}
+
+// hash of a leaf in the same root bucket as hash
+size_t leaf_hash(
+		struct lfht_node *leaf,
+		size_t hash)
+{
+#if LFHT_COMPACT_LEAVES
+	return ((size_t) leaf->hash_high << LEAF_IMPLIED_BITS) |
+		(hash & (((size_t) 1 << LEAF_IMPLIED_BITS) - 1));
+#else
+	(void) hash;
+	return leaf->leaf.hash;
+#endif
+}
+
+// keys are only compared once hashes match
+unsigned leaf_match(
+		struct lfht_head *lfht,
+		struct lfht_node *leaf,
+		size_t hash,
+		const struct lfht_key *key)
+{
+	if(leaf_hash(leaf, hash) != hash) {
+		return 0;
+	}
+
+	return !key || lfht->key_eq(
+			leaf->leaf.key,
+			leaf->leaf.key_len,
+			key->ptr,
+			key->len);
+}
+
+// chains of tables with sorted_chains are in increasing hash order,
+// or decreasing on reversed levels (see adjust_node())
+//
+// returns: 1 if a leaf of hash would be before leaf in its chain
+unsigned leaf_after(
+		struct lfht_node *hnode,
+		struct lfht_node *leaf,
+		size_t hash)
+{
+	size_t leaf_h = leaf_hash(leaf, hash);
+
+	return hnode->hash.reversed ? leaf_h < hash : leaf_h > hash;
+}
+
+// retries CAS until it succeeds
+int force_cas(struct lfht_node *node, struct lfht_node *replace)
+{
+	struct lfht_node *expect = get_next(node);
+
+	if(is_invalid(expect)) {
+		return 0;
+	}
+
+	if(expect == replace) {
+		// value already in place
+		return 1;
+	}
+
+	while(!ref_cas(
+				&(node->leaf.next),
+				&expect,
+				replace,
+				memory_order_acq_rel,
+				memory_order_consume)) {
+		if(is_invalid(expect)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// head -> compression node loaded from bucket
+//
+// the level head points to is retired once head leaves the bucket,
+// so that is checked again once the level is protected
+//
+// returns: the protected level, NULL if head left the bucket
+struct lfht_node *protect_behind(
+		struct lfht_head *lfht,
+		int thread_id,
+		_Atomic(lfht_ref) *bucket,
+		struct lfht_node *head)
+{
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	struct lfht_node *nxt = get_next(head);
+
+	hp_protect(lfht->dom, hp, nxt);
+	if(get_next(head) != nxt || ref_load(
+				bucket,
+				memory_order_seq_cst) != head) {
+		return NULL;
+	}
+	return nxt;
+}
+
+// hnode -> parent hash node of lnode
+// lnode -> will point to the target node, if it exists
+// chain -> filled in for insertions, the whole chain is walked
+//
+// returns: 0/1 success
+int lookup(
+		struct lfht_head *lfht,
+		int thread_id,
+		size_t hash,
+		const struct lfht_key *key,
+		struct lfht_node **hnode,
+		struct lfht_node **lnode,
+		struct lfht_chain *chain)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->lookups++;
+	stats->operations++;
+#endif
+
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	// set once the path went through a merge in progress
+	unsigned uncached = 0;
+
+#if LFHT_JUMP_CACHE
+	if(*hnode == lfht->entry_hash) {
+		*hnode = jump_get(lfht, thread_id, hash);
+	}
+#endif
+	if(*hnode == lfht->entry_hash && lfht->dir) {
+		*hnode = dir_get(lfht, thread_id, hash);
+	}
+
+start: ;
+	// HP.protect uses a ring buffer to protect references
+	// the following protection prevents the *hnode reference from
+	// getting overwritten from its HP after a few retrials
+	if (*hnode != lfht->entry_hash) {
+		hp_protect(lfht->dom, hp, *hnode);
+	}
+
+#if LFHT_STATS
+	stats->max_retry_counter++;
+#endif
+
+traversal: ;
+	if(lfht->merge_levels) {
+		// the chain of a merge target may outgrow the ring
+		// (see merge_pending()), slot 3 keeps the level protected
+		hp_set(lfht->dom, lfht->merge_hazard_pointers[thread_id], *hnode, 3);
+	}
+
+#if LFHT_FILTERS
+	// loaded before the bucket, see filter_update()
+	uint64_t filter = chain ? 0 : atomic_load_explicit(
+			get_filter(hash, *hnode),
+			memory_order_seq_cst);
+	uint64_t seen = 0;
+#endif
+
+	// load bucket entry
+
+	_Atomic(lfht_ref) *bucket =
+		get_atomic_bucket(hash, *hnode);
+
+	_Atomic(lfht_ref) *prev = bucket;
+
+	struct lfht_node *iter = ref_load(
+			prev,
+			memory_order_consume);
+
+	hp_protect(lfht->dom, hp, iter);
+	// is hazard pointer safe?
+	if(iter != ref_load(
+				prev,
+				memory_order_consume)) {
+		// hazard pointer unprotected, retry
+		goto start;
+	}
+
+	struct lfht_node *head = iter;
+	*lnode = head;
+
+	if(is_compressed(*hnode)) {
+		// its buckets keep the freeze node, which is retired along
+		// with it, so head may not be read
+		*hnode = get_prev(lfht, thread_id, *hnode);
+		goto traversal;
+	}
+
+	if(is_compression_node(head)) {
+		// skip compression node
+		struct lfht_node *nxt = get_next(head);
+
+		if(nxt == *hnode) {
+			if(atomic_load_explicit(
+						&(head->leaf.value),
+						memory_order_seq_cst) == ABORTED) {
+				// frozen late, its compression was aborted
+				ref_cas(
+						bucket,
+						&head,
+						nxt,
+						memory_order_acq_rel,
+						memory_order_consume);
+				goto traversal;
+			}
+			// hash node compressed completely
+			*hnode = get_prev(lfht, thread_id, *hnode);
+			goto traversal;
+		}
+
+		nxt = protect_behind(lfht, thread_id, bucket, head);
+		if(!nxt) {
+			goto start;
+		}
+
+		*hnode = nxt;
+		compress(lfht, thread_id, hnode, hash);
+		goto start;
+	}
+
+	if(lfht->compress_delay && head == *hnode && !chain &&
+			is_idle_over(*hnode)) {
+		// the level stayed empty for its whole idle age
+		compress(lfht, thread_id, hnode, hash);
+		goto start;
+	}
+
+#if LFHT_FILTERS
+	if(!chain && head->type == LEAF &&
+			!(filter & (filter_bit(hash, *hnode) | FILTER_EXPANDED))) {
+		// miss, the chain need not be walked
+		return 0;
+	}
+#endif
+
+	if(chain) {
+		chain->tail = prev;
+		chain->count = iter->type == LEAF ? 1 : 0;
+		chain->diff = 0;
+		chain->slot = NULL;
+	}
+
+	// traverse chain (tail points back to hash node)
+
+	while(iter != *hnode) {
+#if LFHT_STATS
+		stats->paths++;
+#endif
+
+		if(iter->type == HASH) {
+			// onto next tree level
+			if(is_root(iter)) {
+				// an old root forwards to the one it grew into
+				*hnode = iter;
+				goto traversal;
+			}
+			if(is_merge_target(*hnode, iter)) {
+				// the levels below hold only the buckets merged
+				// so far, they may not serve their whole prefix
+				uncached = 1;
+			}
+			if(!uncached && lfht->dir && iter->hash.hash_pos <= lfht->dir_bits) {
+				dir_set(lfht, thread_id, hash, *hnode, iter);
+			}
+			*hnode = iter;
+#if LFHT_JUMP_CACHE
+			if(!uncached) {
+				jump_put(lfht, thread_id, hash, iter);
+			}
+#endif
+			goto traversal;
+		}
+
+		// traverse collision chain
+		struct lfht_node *nxt_iter = get_next(iter);
+
+		if(!is_invalid(nxt_iter) && is_removed(iter)) {
+			// help the pending removal of iter
+			if(!mark_invalid(lfht, thread_id, *hnode, iter, &nxt_iter, hash)) {
+				goto start;
+			}
+		}
+
+		struct lfht_node* nxt = valid_ptr(nxt_iter);
+
+		if(is_invalid(nxt_iter) && moved_on(*hnode, nxt_iter)) {
+			// help the move instead, as mark_invalid() does
+			hp_protect(lfht->dom, hp, nxt);
+			if(get_next(iter) == nxt_iter) {
+				help_expansion(lfht, thread_id, *hnode, nxt, hash);
+			}
+			goto start;
+		}
+
+		if(is_invalid(nxt_iter)) {
+			// remove iter
+
+			struct lfht_node *expect = iter;
+			if(!ref_cas(
+						prev,
+						&expect,
+						nxt,
+						memory_order_acq_rel,
+						memory_order_consume)) {
+				// failed to detach, retry
+				goto start;
+			}
+
+			stats->memory_free += node_size(lfht, iter);
+			hp_retire(lfht->dom, thread_id, hp, iter);
+
+			// check if we should compress
+
+			unsigned emptied = prev == bucket && nxt == *hnode;
+			if(emptied) {
+				hp_protect(lfht->dom, hp, *hnode);
+
+				// bucket was left empty
+				count_bucket(*hnode, -1);
+				if(lfht->compress_delay) {
+					if(!is_root(*hnode) && is_empty(*hnode)) {
+						defer_compress(lfht, thread_id, *hnode);
+					}
+				} else if(compress(lfht, thread_id, hnode, hash)) {
+					goto start;
+				}
+			}
+
+			// or merge, the parent too after a compression
+			if(lfht->merge_levels && (emptied || (*hnode)->hash.size == 0)) {
+				// the attempt reuses the HPs of this path, start over
+				try_merge(lfht, thread_id, *hnode, hash);
+				*hnode = lfht->entry_hash;
+				goto start;
+			}
+
+		} else {
+			// iter is a valid node
+
+			if(leaf_match(lfht, iter, hash, key)) {
+				*lnode = iter;
+				return 1;
+			}
+
+			if(lfht->sorted_chains && leaf_after(*hnode, iter, hash)) {
+				// hash would have been before iter
+				if(!chain) {
+					*lnode = iter;
+					return 0;
+				}
+
+				if(!chain->slot) {
+					chain->slot = prev;
+					chain->next = iter;
+				}
+			}
+			*lnode = nxt_iter;
+
+			prev = &(iter->leaf.next);
+			if(chain) {
+				chain->tail = prev;
+				chain->count++;
+				chain->diff |= leaf_hash(iter, hash) ^ hash;
+			}
+#if LFHT_FILTERS
+			seen |= filter_bit(leaf_hash(iter, hash), *hnode);
+#endif
+		}
+
+		hp_protect(lfht->dom, hp, nxt);
+		if(nxt != ref_load(
+					prev,
+					memory_order_seq_cst)) {
+			goto start;
+		}
+
+		if(nxt->type == HASH && nxt != *hnode) {
+			// expansion detected
+			help_expansion(
+					lfht,
+					thread_id,
+					*hnode,
+					nxt,
+					hash);
+
+			goto start;
+		}
+
+		// advance chain
+		iter = nxt;
+	}
+
+	if(chain && !chain->slot) {
+		chain->slot = chain->tail;
+		chain->next = *hnode;
+	}
+
+#if LFHT_FILTERS
+	if(!chain) {
+		filter_update(hash, *hnode, filter, seen);
+	}
+#endif
+	return 0;
+}
+
+// remove functions
+
+// the value is replaced by the removed marker, which linearizes the
+// removal, and lookup() then marks and detaches the leaf
+void search_remove(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash,
+		const struct lfht_key *key)
+{
+start: ;
+	// start from root
+	// both nodes protected by HPs from the lookup function
+	struct lfht_node *cnode;
+	if(!lookup(lfht, thread_id, hash, key, &hnode, &cnode, NULL)) {
+		return;
+	}
+
+	void *value = atomic_load_explicit(
+			&(cnode->leaf.value),
+			memory_order_consume);
+
+	do {
+		if(value == REMOVED) {
+			// removed concurrently, look for a newer leaf
+			goto start;
+		}
+	} while(!atomic_compare_exchange_weak_explicit(
+				&(cnode->leaf.value),
+				&value,
+				REMOVED,
+				memory_order_acq_rel,
+				memory_order_consume));
+
+	add_size(lfht, thread_id, -1);
+
+	// this will detach any invalid nodes
+	lookup(lfht, thread_id, hash, key, &hnode, &cnode, NULL);
+}
+
+// insertion functions
+
+// replace -> swap the value of an existing leaf
+// inserted -> if not NULL, set to whether a new leaf was inserted,
+// a leaf found with a NULL value returns NULL too
+//
+// returns: previous value, NULL if a new leaf was inserted
+void *search_insert(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash,
+		const struct lfht_key *key,
+		void *value,
+		int replace,
+		int *inserted)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->operations++;
+#endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	// set once the chain must grow instead (see merge_pending())
+	unsigned pending = 0;
+
+start: ;
+#if LFHT_STATS
+	stats->max_retry_counter++;
+#endif
+
+	struct lfht_node *cnode;
+	struct lfht_chain chain;
+
+	if(lookup(lfht, thread_id, hash, key, &hnode, &cnode, &chain)) {
+		// node already inserted
+		void *old = atomic_load_explicit(
+				&(cnode->leaf.value),
+				memory_order_consume);
+
+		while(old != REMOVED) {
+			if(!replace || atomic_compare_exchange_weak_explicit(
+						&(cnode->leaf.value),
+						&old,
+						value,
+						memory_order_acq_rel,
+						memory_order_consume)) {
+				if(inserted) {
+					*inserted = 0;
+				}
+				return old;
+			}
+		}
+
+		// removed concurrently
+		goto start;
+	}
+
+	//if(cnode->type == FREEZE &&
+	//		!unfreeze(lfht, thread_id, hnode, hash)) {
+	if(cnode->type == FREEZE) {
+		goto start;
+	}
+
+	// expand hash level, or grow the root
+	// unless every bit of the hash has been consumed
+	// (distinct keys with the same hash)
+	if(chain.count >= lfht->max_chain_nodes && is_root(hnode) &&
+			hnode->hash.size < lfht->max_root_hash_size) {
+		// a root that may still grow is never expanded
+		if(chain.diff & (((size_t) 1 << lfht->max_root_hash_size) - 1)) {
+			grow_root(lfht, thread_id, hnode);
+			hnode = lfht->entry_hash;
+			goto start;
+		}
+
+		// the leaves share every bit the root could take, growing
+		// would not split them
+		stop_root_growth(lfht, hnode);
+	}
+	if(chain.count >= lfht->max_chain_nodes && !pending &&
+			hnode->hash.hash_pos + hnode->hash.size + lfht->min_hash_size <=
+			(int) (8 * sizeof(size_t))) {
+		if(lfht->merge_levels && merge_pending(lfht, thread_id, hnode, hash)) {
+			pending = 1;
+			goto start;
+		}
+
+		struct lfht_node *new_hash;
+		// add new level to tail of chain
+		int size = expansion_size(lfht, hnode, chain.diff, chain.count);
+		if(expand(lfht, thread_id, &new_hash, hnode, size, hash, chain.tail)) {
+			// level added
+			hnode = new_hash;
+		}
+
+		goto start;
+	}
+
+	// insert new node in current bucket
+	struct lfht_node *new_node = create_leaf_node(
+			lfht,
+			thread_id,
+			hash,
+			key,
+			value,
+			chain.next);
+	stats->memory_alloc += node_size(lfht, new_node);
+#if LFHT_FILTERS
+	filter_begin(hash, hnode, filter_bit(hash, hnode));
+#endif
+	int linked = ref_cas(
+			chain.slot,
+			&(chain.next),
+			new_node,
+			memory_order_acq_rel,
+			memory_order_consume);
+#if LFHT_FILTERS
+	filter_end(hash, hnode);
+#endif
+	if(linked) {
+		if(chain.next == hnode &&
+				chain.slot == get_atomic_bucket(hash, hnode) &&
+				count_bucket(hnode, 1) <= 0 && lfht->compress_delay) {
+			reuse_level(lfht, thread_id, hnode);
+		}
+		add_size(lfht, thread_id, 1);
+		if(inserted) {
+			*inserted = 1;
+		}
+		return NULL;
+	}
+
+	stats->memory_free += node_size(lfht, new_node);
+	node_free(lfht, thread_id, new_node);
+	goto start;
+}
+
+// read-modify-write functions
+
+// fn is applied to the value found by lookup() and the result is
+// installed with a CAS on the value word of the leaf
+void *search_compute(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash,
+		const struct lfht_key *key,
+		lfht_compute_fn fn,
+		void *ctx)
+{
+start: ;
+	struct lfht_node *cnode;
+	if(!lookup(lfht, thread_id, hash, key, &hnode, &cnode, NULL)) {
+		void *value = fn(NULL, ctx);
+		if(!value) {
+			return value;
+		}
+
+		int inserted;
+		search_insert(lfht, thread_id, hnode, hash, key, value, 0, &inserted);
+		if(inserted) {
+			return value;
+		}
+
+		// inserted concurrently, apply fn to its value
+		goto start;
+	}
+
+	void *old = atomic_load_explicit(
+			&(cnode->leaf.value),
+			memory_order_consume);
+
+	while(old != REMOVED) {
+		void *value = fn(old, ctx);
+		if(!atomic_compare_exchange_weak_explicit(
+					&(cnode->leaf.value),
+					&old,
+					value ? value : REMOVED,
+					memory_order_acq_rel,
+					memory_order_consume)) {
+			continue;
+		}
+
+		if(!value) {
+			// this will detach the removed node
+			add_size(lfht, thread_id, -1);
+			lookup(lfht, thread_id, hash, key, &hnode, &cnode, NULL);
+		}
+		return value;
+	}
+
+	// removed concurrently
+	goto start;
+}
+
+// same as search_compute() with an addition,
+// without the indirect call
+size_t search_fetch_add(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash,
+		const struct lfht_key *key,
+		size_t delta)
+{
+start: ;
+	struct lfht_node *cnode;
+	if(!lookup(lfht, thread_id, hash, key, &hnode, &cnode, NULL)) {
+		int inserted;
+		search_insert(lfht, thread_id, hnode, hash, key, (void *) delta, 0, &inserted);
+		if(inserted) {
+			return 0;
+		}
+
+		// inserted concurrently, maybe with a value of 0
+		goto start;
+	}
+
+	// no plain fetch_add, it could overwrite the removed marker
+	void *old = atomic_load_explicit(
+			&(cnode->leaf.value),
+			memory_order_consume);
+
+	while(old != REMOVED) {
+		if(atomic_compare_exchange_weak_explicit(
+					&(cnode->leaf.value),
+					&old,
+					(void *) ((size_t) old + delta),
+					memory_order_acq_rel,
+					memory_order_consume)) {
+			return (size_t) old;
+		}
+	}
+
+	// removed concurrently
+	goto start;
+}
+
+// compression functions
+
+int compress(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node **hnode,
+		size_t hash)
+{
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+	stats->operations++;
+#endif
+
+start: ;
+
+#if LFHT_STATS
+	stats->max_retry_counter++;
+#endif
+
+	struct lfht_node *target = *hnode;
+
+	struct lfht_node *prev_hash = ref_load(
+			&(target->hash.prev),
+			memory_order_consume);
+
+	if(prev_hash == NULL || !is_empty(target)) {
+		// we cannot compress the root hash or a non empty hash
+		return 0;
+	}
+
+	struct lfht_node *freeze = create_freeze_node(lfht, thread_id, target);
+	stats->memory_alloc += node_size(lfht, freeze);
+	// whoever ends the compression retires it, maybe before this
+	// thread is done freezing buckets with it
+	hp_protect(lfht->dom, hp, freeze);
+	struct lfht_node *expect;
+
+	// get_prev() tries to protect the previous hash node
+	prev_hash = get_prev(lfht, thread_id, target);
+
+	_Atomic(lfht_ref) *atomic_bucket =
+		get_atomic_bucket(hash, prev_hash);
+
+	// try to place freeze node in front of bucket,
+	// pointing to target hash
+	expect = target;
+	if(!ref_cas(
+				atomic_bucket,
+				&expect,
+				freeze,
+				memory_order_acq_rel,
+				memory_order_consume)) {
+		stats->memory_free += node_size(lfht, freeze);
+		node_free(lfht, thread_id, freeze);
+
+		hp_protect(lfht->dom, hp, expect);
+		if(expect != ref_load(
+					atomic_bucket,
+					memory_order_consume)) {
+			goto start;
+		}
+
+		if(!is_compression_node(expect) || get_next(expect) != target) {
+			return 1;
+		}
+
+		// aid compression
+		freeze = expect;
+	}
+#if LFHT_STATS
+	else {
+		stats->freeze_counter++;
+	}
+#endif
+
+	// freeze empty buckets
+	void *outcome = COMMITTED;
+	for(int i = 0; i < (1<<target->hash.size); i++) {
+		_Atomic(lfht_ref) *nxt_atomic_bucket =
+			&(target->hash.array[i]);
+
+		expect = target;
+		if(!ref_cas(
+					nxt_atomic_bucket,
+					&expect,
+					freeze,
+					memory_order_acq_rel,
+					memory_order_consume) && expect != freeze) {
+			// bucket not empty
+			outcome = ABORTED;
+			break;
+		}
+	}
+
+	// helpers may still be freezing buckets after another thread saw
+	// a non empty one, so all of them agree on the outcome first
+	if(decide(freeze, outcome) == ABORTED) {
+		abort_compress(lfht, thread_id, target, freeze, freeze, atomic_bucket);
+		goto start;
+	}
+
+	// this prevents the parent hash node from being referenced
+	// after it has been reclaimed
+	ref_store(
+			&(target->hash.prev),
+			NULL,
+			memory_order_seq_cst);
+
+	// removing hash from the trie (commit)
+	expect = freeze;
+	if(ref_cas(
+				atomic_bucket,
+				&expect,
+				prev_hash,
+				memory_order_acq_rel,
+				memory_order_consume)) {
+		// this thread was the one to commit compression
+		// it is responsible for freeing memory
+		count_bucket(prev_hash, -1);
+		if(lfht->compress_delay && !is_root(prev_hash) &&
+				is_empty(prev_hash)) {
+			defer_compress(lfht, thread_id, prev_hash);
+		}
+		if(lfht->dir) {
+			dir_replace(lfht, thread_id, hash, target, prev_hash);
+		}
+#if LFHT_JUMP_CACHE
+		atomic_fetch_add_explicit(
+				&(lfht->jump_epoch),
+				1,
+				memory_order_seq_cst);
+#endif
+		stats->memory_free += node_size(lfht, freeze);
+		stats->memory_free += node_size(lfht, target);
+		hp_retire(lfht->dom, thread_id, hp, freeze);
+		hp_retire(lfht->dom, thread_id, hp, target);
+
+#if LFHT_STATS
+		// compressed level
+		stats->compression_counter++;
+#endif
+	}
+
+	// try to compress previous level
+	*hnode = prev_hash;
+	if(lfht->compress_delay) {
+		// unless it waits for its own idle age
+		return 0;
+	}
+	goto start;
+}
+
+// the first outcome given for the compression of freeze wins
+//
+// returns: the outcome that won
+void *decide(
+		struct lfht_node *freeze,
+		void *outcome)
+{
+	void *expect = NULL;
+	if(atomic_compare_exchange_strong_explicit(
+				&(freeze->leaf.value),
+				&expect,
+				outcome,
+				memory_order_seq_cst,
+				memory_order_seq_cst)) {
+		return outcome;
+	}
+	return expect;
+}
+
+// notify compressing thread to abort compression
+int unfreeze(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *target,
+		size_t hash)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+#endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	_Atomic(lfht_ref) *atomic_bucket =
+		get_atomic_bucket(hash, from_ref(target->hash.prev));
+
+	struct lfht_node *head = ref_load(
+			atomic_bucket,
+			memory_order_consume);
+
+	if(head == target) {
+		// compression rolled back successfully
+		return 1;
+	}
+
+	if(head->type == UNFREEZE) {
+		return get_next(head) == target;
+	}
+
+	if(head->type != FREEZE || get_next(head) != target) {
+		// level already removed
+		return 0;
+	}
+
+	// head is freeze node
+
+	struct lfht_node *unfreeze = create_unfreeze_node(lfht, thread_id, target);
+	stats->memory_alloc += node_size(lfht, unfreeze);
+	hp_protect(lfht->dom, hp, unfreeze);
+
+	// try to place unfreeze node in front of bucket,
+	// pointing to freeze node
+	if(!ref_cas(
+				atomic_bucket,
+				&head,
+				unfreeze,
+				memory_order_acq_rel,
+				memory_order_consume)) {
+		// already compressed, unfrozen or removed
+		stats->memory_free += node_size(lfht, unfreeze);
+		node_free(lfht, thread_id, unfreeze);
+
+		if(head == target) {
+			// compression rolled back successfully
+			return 1;
+		}
+
+		if(head->type == UNFREEZE) {
+			return get_next(head) == target;
+		}
+
+		return 0;
+	}
+
+	// we removed the freeze node, so we should retire it
+	stats->memory_free += node_size(lfht, head);
+	hp_retire(lfht->dom, thread_id, hp, head);
+
+#if LFHT_STATS
+	stats = atomic_load_explicit(&(lfht->stats[thread_id]), memory_order_relaxed);
+	stats->unfreeze_counter++;
+#endif
+	return 1;
+}
+
+// target -> hash level we wanted to compress
+// atomic_bucket -> atomic object of the previous level
+//   bucket pointing to our target
+//
+// every thread that froze buckets of target calls it once the
+// compression is aborted, which resets the ones it froze late
+void abort_compress(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *target,
+		struct lfht_node *freeze,
+		struct lfht_node *head,
+		_Atomic(lfht_ref) *atomic_bucket)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = atomic_load_explicit(&(lfht->stats[thread_id]), memory_order_relaxed);
+#endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	struct lfht_node *expect;
+
+	// point all buckets to target
+	for(int i = 0; i < (1<<target->hash.size); i++) {
+		_Atomic(lfht_ref) *nxt_atomic_bucket = &(target->hash.array[i]);
+		expect = freeze;
+
+		// ignoring CAS failure
+		// just making sure all buckets point to target
+		// if it fails, they already do point to target or have a chain
+		ref_cas(
+				nxt_atomic_bucket,
+				&expect,
+				target,
+				memory_order_acq_rel,
+				memory_order_consume);
+	}
+
+	// commit level by removing compression bridge node
+	if(ref_cas(
+			atomic_bucket,
+			&head,
+			target,
+			memory_order_acq_rel,
+			memory_order_consume)) {
+		// retire compression node
+		stats->memory_free += node_size(lfht, head);
+		hp_retire(lfht->dom, thread_id, hp, head);
+	}
+
+#if LFHT_STATS
+	stats = atomic_load_explicit(&(lfht->stats[thread_id]), memory_order_relaxed);
+	stats->compression_rollback_counter++;
+#endif
+}
+
+// merge functions
+
+// with merge_levels, a level left with fewer leaves than
+// max_chain_nodes, counting those of the single bucket levels below
+// it, is replaced by a single bucket level at the same hash_pos that
+// holds them in one chain (the parent bucket cannot take them, as a
+// chain ends at the level that owns it).
+// each bucket is moved the way expand() moves a chain: the new level
+// is linked at its tail, help_expansion() moves the leaves and points
+// the bucket to the new level. once every bucket does, the parent
+// bucket is pointed to it and the old level is retired. until then
+// the new level is shared by the buckets merged so far, so lookups
+// that go through it cache none of the levels they find (see
+// lookup()). every step leaves a valid trie: a merge that meets a
+// wider level below just stops, and a later one resumes it.
+
+// after a removal from hnode, merges it, or its parent if hnode is a
+// single bucket level, once sparse
+void try_merge(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash)
+{
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	if(hnode->hash.size == 0) {
+		if(is_compressed(hnode)) {
+			return;
+		}
+		hnode = get_prev(lfht, thread_id, hnode);
+	}
+
+	if(is_root(hnode) || hnode->hash.size == 0) {
+		// single bucket levels are what merges leave
+		return;
+	}
+
+	int occupied = atomic_load_explicit(
+			&(hnode->hash.occupied),
+			memory_order_relaxed);
+	if(occupied <= 0) {
+		// left to compress()
+		return;
+	}
+
+	if(occupied >= (int) lfht->max_chain_nodes) {
+		// unless a merge stopped halfway, the buckets it merged
+		// count as occupied
+		struct lfht_node *head = ref_load(
+				&(hnode->hash.array[0]),
+				memory_order_consume);
+
+		hp_protect(lfht->dom, hp, head);
+		if(head != ref_load(
+					&(hnode->hash.array[0]),
+					memory_order_seq_cst) ||
+				head->type != HASH || head == hnode ||
+				!is_merge_target(hnode, head)) {
+			return;
+		}
+	}
+
+	if(level_population(lfht, thread_id, hnode, lfht->max_chain_nodes) <
+			lfht->max_chain_nodes) {
+		merge(lfht, thread_id, hnode, hash);
+	}
+}
+
+// a target that expanded before the merged level is replaced would
+// leave the new level below the buckets still moving to the target
+// too, so its chain grows until then
+//
+// returns: 1 if hnode is the target of a merge still in progress
+unsigned merge_pending(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash)
+{
+	if(hnode->hash.size > 0 || hnode == lfht->entry_hash) {
+		return 0;
+	}
+
+	struct lfht_node *parent = get_prev(lfht, thread_id, hnode);
+
+	return ref_load(
+			get_atomic_bucket(hash, parent),
+			memory_order_seq_cst) != hnode;
+}
+
+// counts the leaves of the protected hnode and of the single bucket
+// levels below it, removed ones too
+//
+// returns: the count, or limit once it gets there, or if hnode holds
+// wider levels or is changing
+unsigned level_population(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		unsigned limit)
+{
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	// the target of a merge in progress is counted once
+	struct lfht_node *counted = NULL;
+	unsigned count = 0;
+
+	for(int i = 0; i < 1<<hnode->hash.size; i++) {
+		// a bucket protects fewer nodes than the ring holds
+		hp_protect(lfht->dom, hp, hnode);
+
+		struct lfht_node *owner = hnode;
+		_Atomic(lfht_ref) *prev = &(hnode->hash.array[i]);
+		struct lfht_node *nxt = ref_load(
+				prev,
+				memory_order_consume);
+
+		while(valid_ptr(nxt) != owner) {
+			struct lfht_node *iter = valid_ptr(nxt);
+
+			hp_protect(lfht->dom, hp, iter);
+			if(nxt != ref_load(
+						prev,
+						memory_order_seq_cst) || is_compressed(owner)) {
+				return limit;
+			}
+
+			if(iter->type == LEAF) {
+				if(++count >= limit) {
+					return limit;
+				}
+				prev = &(iter->leaf.next);
+			} else if(iter->type == HASH && owner == hnode &&
+					iter->hash.size == 0) {
+				if(iter == counted) {
+					break;
+				}
+				if(is_merge_target(hnode, iter)) {
+					counted = iter;
+				}
+				owner = iter;
+				prev = &(iter->hash.array[0]);
+			} else {
+				// wider level, expansion or compression
+				return limit;
+			}
+
+			nxt = ref_load(
+					prev,
+					memory_order_consume);
+		}
+	}
+
+	return count;
+}
+
+// hnode -> protected level below the root
+// hash -> a hash on the path of hnode
+//
+// returns: 1 if this thread replaced hnode
+int merge(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		size_t hash)
+{
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	struct lfht_node *parent = get_prev(lfht, thread_id, hnode);
+	if(parent != ref_load(
+				&(hnode->hash.prev),
+				memory_order_seq_cst)) {
+		// compressed or merged meanwhile
+		return 0;
+	}
+
+	struct lfht_node *target = NULL;
+	size_t prefix = hash & (((size_t) 1 << hnode->hash.hash_pos) - 1);
+
+	for(size_t i = 0; i < (size_t) 1 << hnode->hash.size; i++) {
+		if(!merge_bucket(
+					lfht,
+					thread_id,
+					hnode,
+					parent,
+					&target,
+					prefix | (i << hnode->hash.hash_pos))) {
+			return 0;
+		}
+	}
+
+	// no bucket of hnode leads to a leaf anymore
+	hp_protect(lfht->dom, hp, parent);
+	if(parent != ref_load(
+				&(hnode->hash.prev),
+				memory_order_seq_cst)) {
+		return 0;
+	}
+
+	struct lfht_node *expect = hnode;
+	if(!ref_cas(
+				get_atomic_bucket(hash, parent),
+				&expect,
+				target,
+				memory_order_acq_rel,
+				memory_order_consume)) {
+		// replaced by another thread, or a compression of hnode
+		// is failing on its buckets, lookups pass through it
+		return 0;
+	}
+
+	retire_merged(lfht, thread_id, hnode, target, hash);
+	return 1;
+}
+
+// points the bucket of hash in hnode to *target, once the leaves of
+// its chain, or of the single bucket level it holds, moved there.
+// the first bucket creates *target or takes the one of another thread
+//
+// returns: 0 if the merge must stop
+int merge_bucket(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		struct lfht_node *parent,
+		struct lfht_node **target,
+		size_t hash)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+#endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	_Atomic(lfht_ref) *bucket = get_atomic_bucket(hash, hnode);
+	// freed unless it gets linked
+	struct lfht_node *fresh = NULL;
+	int res = 0;
+
+	if(!*target) {
+		fresh = create_hash_node(
+				lfht,
+				thread_id,
+				0,
+				hnode->hash.hash_pos,
+				parent);
+		stats->memory_alloc += node_size(lfht, fresh);
+	}
+
+start: ;
+	hp_protect(lfht->dom, hp, parent);
+	hp_protect(lfht->dom, hp, *target ? *target : fresh);
+	hp_protect(lfht->dom, hp, hnode);
+
+	struct lfht_node *head = ref_load(
+			bucket,
+			memory_order_consume);
+
+	hp_protect(lfht->dom, hp, head);
+	if(head != ref_load(
+				bucket,
+				memory_order_seq_cst)) {
+		goto start;
+	}
+
+	if(is_compressed(hnode)) {
+		// replaced by another thread, head may be its freeze node,
+		// retired along with it (see lookup())
+		goto end;
+	}
+
+	if(head == *target) {
+		res = 1;
+		goto end;
+	}
+
+	int linked = 0;
+	if(is_compression_node(head)) {
+		struct lfht_node *nxt = protect_behind(lfht, thread_id, bucket, head);
+		if(!nxt) {
+			goto start;
+		}
+
+		// of the level below, or of hnode, which fails on the
+		// buckets merged so far
+		compress(lfht, thread_id, &nxt, hash);
+		goto start;
+	} else if(head->type == HASH && head != hnode) {
+		if(is_merge_target(hnode, head)) {
+			if(!*target) {
+				// first bucket, merged by another thread
+				*target = head;
+				res = 1;
+			}
+			goto end;
+		}
+
+		if(head->hash.size > 0) {
+			// too wide to merge
+			goto end;
+		}
+
+		// single bucket level of an earlier merge, its chain moves
+		// first and then the level is retired
+		linked = link_target(
+				lfht,
+				thread_id,
+				hnode,
+				head,
+				&(head->hash.array[0]),
+				target,
+				fresh,
+				hash);
+		if(linked > 0) {
+			help_expansion(lfht, thread_id, head, *target, hash);
+
+			struct lfht_node *expect = head;
+			if(ref_load(
+						&(head->hash.array[0]),
+						memory_order_seq_cst) == *target &&
+					ref_cas(
+						bucket,
+						&expect,
+						*target,
+						memory_order_acq_rel,
+						memory_order_consume)) {
+				// lookups of its prefix may start from the root
+				// while the merge goes on
+				retire_merged(lfht, thread_id, head, lfht->entry_hash, hash);
+			}
+		}
+	} else {
+		linked = link_target(
+				lfht,
+				thread_id,
+				hnode,
+				hnode,
+				bucket,
+				target,
+				fresh,
+				hash);
+		if(linked > 0) {
+			help_expansion(lfht, thread_id, hnode, *target, hash);
+		}
+	}
+
+	if(linked) {
+		goto start;
+	}
+
+end:
+	if(fresh && fresh != *target) {
+		stats->memory_free += node_size(lfht, fresh);
+		node_free(lfht, thread_id, fresh);
+	}
+	return res;
+}
+
+// links *target, or fresh if there is none yet, at the tail of the
+// chain of bucket in owner, either hnode or a single bucket level
+// below it. removed leaves are detached on the way, as lookup() does
+//
+// returns: 1 once the chain ends at *target, -1 to retry, or 0 if it
+// ends at a wider level or is too long
+int link_target(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		struct lfht_node *owner,
+		_Atomic(lfht_ref) *bucket,
+		struct lfht_node **target,
+		struct lfht_node *fresh,
+		size_t hash)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+#endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	_Atomic(lfht_ref) *prev = bucket;
+	struct lfht_node *iter = ref_load(
+			prev,
+			memory_order_consume);
+	unsigned int count = 0;
+
+	hp_protect(lfht->dom, hp, iter);
+	if(iter != ref_load(
+				prev,
+				memory_order_seq_cst)) {
+		return -1;
+	}
+
+	while(iter != owner) {
+		if(iter->type == HASH) {
+			if(!is_merge_target(hnode, iter) ||
+					(*target && iter != *target)) {
+				// expansion
+				return 0;
+			}
+			*target = iter;
+			return 1;
+		}
+
+		if(iter->type != LEAF) {
+			// compression of owner
+			return -1;
+		}
+
+		if(++count >= lfht->max_chain_nodes) {
+			return 0;
+		}
+
+		struct lfht_node *nxt = get_next(iter);
+
+		if(!is_invalid(nxt) && is_removed(iter) &&
+				!mark_invalid(lfht, thread_id, owner, iter, &nxt, hash)) {
+			return -1;
+		}
+
+		if(is_invalid(nxt) && !moved_on(owner, nxt)) {
+			struct lfht_node *expect = iter;
+			if(ref_cas(
+						prev,
+						&expect,
+						valid_ptr(nxt),
+						memory_order_acq_rel,
+						memory_order_consume)) {
+				stats->memory_free += node_size(lfht, iter);
+				hp_retire(lfht->dom, thread_id, hp, iter);
+				if(prev == bucket && valid_ptr(nxt) == owner) {
+					count_bucket(owner, -1);
+				}
+			}
+			return -1;
+		}
+
+		prev = &(iter->leaf.next);
+		hp_protect(lfht->dom, hp, valid_ptr(nxt));
+		if(nxt != ref_load(
+					prev,
+					memory_order_seq_cst)) {
+			return -1;
+		}
+		iter = valid_ptr(nxt);
+	}
+
+	struct lfht_node *link = *target ? *target : fresh;
+	struct lfht_node *expect = owner;
+
+#if LFHT_FILTERS
+	filter_begin(hash, owner, FILTER_EXPANDED);
+#endif
+	int linked = ref_cas(
+			prev,
+			&expect,
+			link,
+			memory_order_acq_rel,
+			memory_order_consume);
+#if LFHT_FILTERS
+	filter_end(hash, owner);
+#endif
+	if(!linked) {
+		return -1;
+	}
+
+	if(prev == bucket) {
+		count_bucket(owner, 1);
+	}
+	*target = link;
+	return 1;
+}
+
+// level was replaced by replace in the bucket that held it
+void retire_merged(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *level,
+		struct lfht_node *replace,
+		size_t hash)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+#endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	// cleared before jump_epoch is bumped, as in compress()
+	ref_store(
+			&(level->hash.prev),
+			NULL,
+			memory_order_seq_cst);
+
+	if(lfht->dir) {
+		dir_replace(lfht, thread_id, hash, level, replace);
+	}
+#if LFHT_JUMP_CACHE
+	atomic_fetch_add_explicit(
+			&(lfht->jump_epoch),
+			1,
+			memory_order_seq_cst);
+#endif
+	stats->memory_free += node_size(lfht, level);
+	hp_retire(lfht->dom, thread_id, hp, level);
+
+#if LFHT_STATS
+	stats->merge_counter++;
+#endif
+}
+
+// expansion functions
+
+int help_expansion(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *hnode,
+		struct lfht_node *target,
+		size_t hash)
+{
+	if(target->type != HASH || target == hnode) {
+		return 0;
+	}
+
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	// recursive helping
+	int pos = get_bucket_index(
+			hash,
+			hnode->hash.hash_pos,
+			hnode->hash.size);
+
+	// move all nodes of chain to new level
+	_Atomic(lfht_ref) *parent_bucket =
+		&(hnode->hash.array[pos]);
+
+	struct lfht_node *head = ref_load(
+			parent_bucket,
+			memory_order_consume);
+
+	// check if expansion has terminated
+	if(head == target) {
+		return 1;
+	}
+
+	// check if new hash node has been compressed
+	if(is_compressed(target)) {
+		return 0;
+	}
+
+	if(!adjust_chain_nodes(
+			lfht,
+			thread_id,
+			target,
+			head,
+			hash)) {
+		// head is no longer the chain that ends at target, e.g. the
+		// level below hnode was since merged into another one
+		return 0;
+	}
+
+	int res = ref_cas(
+			parent_bucket,
+			&head,
+			target,
+			memory_order_acq_rel,
+			memory_order_consume);
+
+	if(is_merge_target(hnode, target) || is_root(target)) {
+		// one of the buckets of a merge or of a root growth, hnode
+		// stays in place
+		return res;
+	}
+
+	if(res && lfht->dir) {
+		dir_replace(lfht, thread_id, hash, hnode, target);
+	}
+
+#if LFHT_STATS
+	if(res) {
+		struct lfht_stats* stats = atomic_load_explicit(&(lfht->stats[thread_id]), memory_order_relaxed);
+		stats->expansion_counter++;
+		int level = target->hash.hash_pos / target->hash.size;
+		if(stats->max_depth < level) {
+			stats->max_depth = level;
+		}
+	}
+#endif
+
+	return res;
+}
+
+int expand(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node **new_hash,
+		struct lfht_node *hnode,
+		int size,
+		size_t hash,
+		_Atomic(lfht_ref) *tail_nxt_ptr)
+{
+#if LFHT_STATS
+	struct lfht_stats* stats = lfht->stats[thread_id];
+#endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+
+	struct lfht_node *exp = hnode;
+
+	*new_hash = create_hash_node(
+			lfht,
+			thread_id,
+			size,
+			hnode->hash.hash_pos + hnode->hash.size,
+			hnode);
+	stats->memory_alloc += node_size(lfht, *new_hash);
+
+	hp_protect(lfht->dom, hp, *new_hash);
+
+#if LFHT_FILTERS
+	filter_begin(hash, hnode, FILTER_EXPANDED);
+#endif
+
+	// add new hash level to tail of chain
+	int linked = ref_cas(
+			tail_nxt_ptr,
+			&exp,
+			*new_hash,
+			memory_order_acq_rel,
+			memory_order_consume);
+#if LFHT_FILTERS
+	filter_end(hash, hnode);
+#endif
+	if(linked) {
+		return help_expansion(
+				lfht,
+				thread_id,
+				hnode,
+				*new_hash,
+				hash);
+	}
+
+	// failed
+	stats->memory_free += node_size(lfht, *new_hash);
+	node_free(lfht, thread_id, *new_hash);
+
+	// protect new hash node
+	hp_protect(lfht->dom, hp, exp);
+	struct lfht_node* tail = ref_load(
+			tail_nxt_ptr,
+			memory_order_consume);
+
+	// the last leaf may have been marked since, its next is then
+	// hnode with the invalid bit
+	if(tail != exp || is_invalid(exp) || exp->type != HASH || exp == hnode) {
+		return 0;
+	}
+
+	*new_hash = exp;
+
+	return help_expansion(
+			lfht,
+			thread_id,
+			hnode,
+			exp,
+			hash);
+}
 
-	if(is_compression_node(head)) {
-		// skip compression node
-		struct lfht_node *nxt = get_next(head);
+// root growth
+//
+// a root narrower than max_root_hash_size never expands a bucket, an
+// insertion into a full chain doubles the root instead. a chain whose
+// leaves share all the bits the root could take would not split, it
+// stops the growth at the width reached and expands as below any
+// other root, as the bulk load does. the wider
+// root is linked at the tail of every bucket in turn, as a new level
+// would be, and help_expansion() moves the leaves there and points
+// the bucket to it, so lookups that start from the old root go on
+// into the new one. helpers find the new root in the first bucket,
+// which is linked first, and the growth ends once entry_hash moves
+// to it.
+// lookups start from entry_hash without protecting it, so roots are
+// not retired, each one forwards to the next until the table is
+// freed (see free_lfht()). their sizes add up to less than the
+// current one.
+
+// root -> root the search stopped at, the current one or the one it
+// grows into
+void stop_root_growth(
+		struct lfht_head *lfht,
+		struct lfht_node *root)
+{
+	int max = lfht->max_root_hash_size;
+	// the narrowest width wins, a bucket of a root narrower than
+	// the one set could be expanded already
+	while(root->hash.size < max &&
+			!atomic_compare_exchange_weak(
+				&(lfht->max_root_hash_size),
+				&max,
+				root->hash.size));
+}
 
-		if(nxt == *hnode) {
-			// hash node compressed completely
-			*hnode = get_prev(lfht, thread_id, *hnode);
-			goto traversal;
-		}
+// root -> full root, the current one or the one it grows into
+void grow_root(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *root)
+{
+	struct lfht_node *current = lfht->entry_hash;
 
-		hp_protect(dom, hp, nxt);
-		if(get_next(head) != nxt) {
-			goto start;
+	if(root != current) {
+		if(root->hash.size < current->hash.size) {
+			// grown meanwhile
+			return;
 		}
 
-		*hnode = nxt;
-		compress(lfht, thread_id, hnode, hash);
-		goto start;
+		// root is the one current grows into, which goes first
+		root = current;
 	}
 
-	if(tail) {
-		*tail = prev;
+	struct lfht_node *next = NULL;
+	for(size_t b = 0; b < (size_t) 1 << root->hash.size; b++) {
+		if(!grow_bucket(lfht, thread_id, root, &next, b)) {
+			return;
+		}
 	}
 
-	if(count) {
-		*count = iter->type == LEAF ? 1 : 0;
+	if(!atomic_compare_exchange_strong_explicit(
+				&(lfht->entry_hash),
+				&root,
+				next,
+				memory_order_seq_cst,
+				memory_order_seq_cst)) {
+		// helped
+		return;
 	}
+#if LFHT_STATS
+	lfht->stats[thread_id]->root_growth_counter++;
+#endif
 
-	// traverse chain (tail points back to hash node)
+	if(lfht->dir) {
+		// lookups from the new root would not move the entries
+		// left at an old one any deeper, nor would a growth that
+		// ends meanwhile
+		for(size_t i = 0; i < (size_t) 1 << lfht->dir_bits; i++) {
+			struct lfht_node *hnode;
+			while((hnode = dir_get(lfht, thread_id, i)) != lfht->entry_hash &&
+					is_root(hnode)) {
+				dir_set(lfht, thread_id, i, hnode, lfht->entry_hash);
+			}
+		}
+	}
+}
 
-	while(iter != *hnode) {
+// links *next at the tail of bucket b of root, a new root if it is
+// not known yet, and moves the leaves of the bucket there
+//
+// returns: 0 if the bucket holds a level below root
+int grow_bucket(
+		struct lfht_head *lfht,
+		int thread_id,
+		struct lfht_node *root,
+		struct lfht_node **next,
+		size_t b)
+{
 #if LFHT_STATS
-		stats->paths++;
+	struct lfht_stats* stats = lfht->stats[thread_id];
 #endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	_Atomic(lfht_ref) *bucket = &(root->hash.array[b]);
 
-		if(iter->type == HASH) {
-			// onto next tree level
-			*hnode = iter;
-			goto traversal;
-		}
+start: ;
+	_Atomic(lfht_ref) *prev = bucket;
+	struct lfht_node *iter = ref_load(
+			prev,
+			memory_order_consume);
 
-		// traverse collision chain
-		struct lfht_node *nxt_iter = get_next(iter);
-		struct lfht_node* nxt = valid_ptr(nxt_iter);
+	hp_protect(lfht->dom, hp, iter);
+	if(iter != ref_load(
+				prev,
+				memory_order_seq_cst)) {
+		goto start;
+	}
 
-		if(is_invalid(nxt_iter)) {
-			// remove iter
+	if(iter == *next) {
+		// bucket moved
+		return 1;
+	}
+
+	while(iter->type == LEAF) {
+		struct lfht_node *nxt = get_next(iter);
 
+		if(is_invalid(nxt) && !moved_on(root, nxt)) {
+			// detached as lookup() does, the link goes after a
+			// valid leaf
 			struct lfht_node *expect = iter;
-			if(!atomic_compare_exchange_strong_explicit(
+			if(ref_cas(
 						prev,
 						&expect,
-						nxt,
+						valid_ptr(nxt),
 						memory_order_acq_rel,
 						memory_order_consume)) {
-				// failed to detach, retry
-				goto start;
-			}
-
-			stats->memory_free += sizeof(*iter);
-			hp_retire(dom, thread_id, hp, iter);
-
-			// check if we should compress
-
-			if(prev == bucket && nxt == *hnode) {
-				hp_protect(dom, hp, *hnode);
-
-				// bucket was left empty
-				if(compress(lfht, thread_id, hnode, hash)) {
-					goto start;
+				stats->memory_free += node_size(lfht, iter);
+				hp_retire(lfht->dom, thread_id, hp, iter);
+				if(prev == bucket && valid_ptr(nxt) == root) {
+					count_bucket(root, -1);
 				}
 			}
-
-			if(iter->leaf.hash == hash) {
-				return 0;
-			}
-
-		} else {
-			// iter is a valid node
-
-			if(iter->leaf.hash == hash) {
-				*lnode = iter;
-				return 1;
-			}
-			*lnode = nxt_iter;
-
-			prev = &(iter->leaf.next);
-			if(tail) {
-				*tail = prev;
-			}
-
-			if(count) {
-				(*count)++;
-			}
+			goto start;
 		}
 
-		hp_protect(dom, hp, nxt);
-		if(nxt != atomic_load_explicit(
+		prev = &(iter->leaf.next);
+		hp_protect(lfht->dom, hp, valid_ptr(nxt));
+		if(nxt != ref_load(
 					prev,
 					memory_order_seq_cst)) {
 			goto start;
 		}
+		iter = valid_ptr(nxt);
+	}
 
-		if(nxt->type == HASH && nxt != *hnode) {
-			// expansion detected
-			help_expansion(
+	if(iter == root) {
+		struct lfht_node *fresh = NULL;
+
+		if(!*next) {
+			// starts the growth, the new root takes one more bit
+			// and the other order of chains (see adjust_node())
+			// from the pools on lean tables, whose pools stay
+			// until their roots are freed (see free_lfht())
+			fresh = create_hash_node(
 					lfht,
-					thread_id,
-					*hnode,
-					nxt,
-					hash);
+					lfht->lean ? thread_id : -1,
+					root->hash.size + 1,
+					0,
+					NULL);
+			fresh->hash.reversed = !root->hash.reversed;
+			fresh->hash.root = 1;
+			*next = fresh;
+		}
 
+		struct lfht_node *expect = root;
+#if LFHT_FILTERS
+		filter_begin(b, root, FILTER_EXPANDED);
+#endif
+		int linked = ref_cas(
+				prev,
+				&expect,
+				*next,
+				memory_order_acq_rel,
+				memory_order_consume);
+#if LFHT_FILTERS
+		filter_end(b, root);
+#endif
+		if(!linked) {
+			if(fresh) {
+				node_free(lfht, -1, fresh);
+				*next = NULL;
+			}
 			goto start;
 		}
 
-		// advance chain
-		iter = nxt;
+		if(prev == bucket) {
+			count_bucket(root, 1);
+		}
+		iter = *next;
 	}
 
-	return 0;
-}
+	if(iter->type != HASH || !is_root(iter) || (*next && iter != *next)) {
+		// levels are only left below a root whose growth stopped
+		// (see stop_root_growth())
+		return 0;
+	}
 
-// remove functions
+	*next = iter;
+	help_expansion(lfht, thread_id, root, iter, b);
+	goto start;
+}
 
-void search_remove(
+// hash -> any hash of the root bucket of the chain
+int adjust_chain_nodes(
 		struct lfht_head *lfht,
 		int thread_id,
 		struct lfht_node *hnode,
+		struct lfht_node *iter,
 		size_t hash)
 {
-
 	HpRecord* hp = lfht->hazard_pointers[thread_id];
 
-start: ;
-	// start from root
-	// both nodes protected by HPs from the lookup function
-	struct lfht_node *cnode;
-	if(!lookup(lfht, thread_id, hash, &hnode, &cnode, NULL, NULL)) {
-		return;
+	if(iter->type != LEAF) {
+		// reached tail
+		return iter == hnode;
 	}
 
-	struct lfht_node *nxt = get_next(cnode);
-
-	if(is_invalid(nxt)) {
-		return;
-	}
+	struct lfht_node *nxt_iter = get_next(iter);
+	struct lfht_node *nxt = valid_ptr(nxt_iter);
 
-	hp_protect(dom, hp, nxt);
-	if(nxt != get_next(cnode)) {
-		goto start;
+	if(!adjust_chain_nodes(
+			lfht,
+			thread_id,
+			hnode,
+			nxt,
+			hash)) {
+		// not the hash we wished to expand
+		return 0;
 	}
 
-	if(nxt->type == HASH && nxt != hnode) {
-		// expansion detected
-		help_expansion(
-				lfht,
-				thread_id,
-				hnode,
-				nxt,
-				hash);
-
-		goto start;
+	if(is_invalid(nxt_iter)) {
+		// skip invalid nodes
+		return 1;
 	}
 
-	// mark invalid
-	if(!atomic_compare_exchange_weak_explicit(
-				&(cnode->leaf.next),
-				&nxt,
-				invalid_ptr(nxt),
-				memory_order_acq_rel,
-				memory_order_consume)
-			&& !is_invalid(nxt)) {
-		// new node inserted in front of cnode
-		// retry
-		goto start;
+	// iter is valid
+	if(!adjust_node(lfht, thread_id, iter, nxt_iter, hnode, hash)) {
+		// the leaves now after iter go first
+		return adjust_chain_nodes(lfht, thread_id, hnode, iter, hash);
 	}
-
-	// this will detach any invalid nodes
-	lookup(lfht, thread_id, hash, &hnode, &cnode, NULL, NULL);
+	return 1;
 }
 
-// insertion functions
-
-void search_insert(
+// leaves are moved from the tail of the chain, each one to the tail
+// of its new bucket, so sorted chains come out in reverse order
+//
+// returns: 0 if cnode is no longer followed by nxt
+int adjust_node(
 		struct lfht_head *lfht,
 		int thread_id,
+		struct lfht_node *cnode,
+		struct lfht_node *nxt,
 		struct lfht_node *hnode,
-		size_t hash,
-		void *value)
+		size_t hash)
 {
 #if LFHT_STATS
 	struct lfht_stats* stats = lfht->stats[thread_id];
 	stats->operations++;
 #endif
-	HpRecord* hp = lfht->hazard_pointers[thread_id];
 
 start: ;
+
 #if LFHT_STATS
 	stats->max_retry_counter++;
 #endif
 
-	struct lfht_node *cnode;
-	 _Atomic(struct lfht_node*) *tail;
-	unsigned int count;
+	unsigned int count = 0;
+	// hnode may be a root that grows (see grow_root()), which takes
+	// the bits compact leaves leave out from hash
+	hash = leaf_hash(cnode, hash);
 
-	if(lookup(lfht, thread_id, hash, &hnode, &cnode, &tail, &count)) {
-		// node already inserted
-		return;
-	}
+	_Atomic(lfht_ref) *current_valid =
+		get_atomic_bucket(hash, hnode);
 
-	//if(cnode->type == FREEZE &&
-	//		!unfreeze(lfht, thread_id, hnode, hash)) {
-	if(cnode->type == FREEZE) {
-		goto start;
+	struct lfht_node *expect;
+
+	if(lfht->merge_levels) {
+		// hnode may be the target of a merge
+		if(merge_tail(lfht, thread_id, cnode, hash, &hnode, &current_valid, &expect)) {
+			return 1;
+		}
+		goto link;
 	}
 
-	// expand hash level
-	if(count >= lfht->max_chain_nodes) {
-		struct lfht_node *new_hash;
-		// add new level to tail of chain
-		if(expand(lfht, thread_id, &new_hash, hnode, hash, tail)) {
-			// level added
-			hnode = new_hash;
+	expect = valid_ptr(ref_load(
+				current_valid,
+				memory_order_consume));
+
+	struct lfht_node *iter = expect;
+
+	// find tail of target bucket on new hash level
+	while(iter->type == LEAF) {
+		struct lfht_node *nxt_ptr = get_next(iter);
+
+		if(is_invalid(nxt_ptr)) {
+			// skip invalid node
+			iter = valid_ptr(nxt_ptr);
+			continue;
+		}
+
+		if(cnode == iter) {
+			// already inserted
+			return 1;
 		}
 
+		current_valid = &(iter->leaf.next);
+		expect = valid_ptr(nxt_ptr);
+		iter = expect;
+		count++;
+	}
+
+	if(is_compression_node(iter)) {
+		// hnode is being compressed, which it cannot be before
+		// cnode moved there, as in merge_tail()
+		return 1;
+	}
+
+	if(iter != hnode) {
+		hnode = iter;
 		goto start;
 	}
 
-	// insert new node in current bucket
-	struct lfht_node *new_node = create_leaf_node(
-			hash,
-			value,
-			hnode);
-	stats->memory_alloc += sizeof(*new_node);
-	if(atomic_compare_exchange_strong_explicit(
-				tail,
-				&cnode,
-				new_node,
+link: ;
+	// point node to newer level
+	if(!ref_cas(
+				&(cnode->leaf.next),
+				&nxt,
+				hnode,
 				memory_order_acq_rel,
-				memory_order_consume)) {
-		return;
+				memory_order_consume) && nxt != hnode) {
+		// removed, or a leaf was linked or unlinked after it
+		return is_invalid(nxt);
 	}
 
-	stats->memory_free += sizeof(*new_node);
-	free(new_node);
-	goto start;
-}
+#if LFHT_FILTERS
+	filter_begin(hash, hnode, filter_bit(hash, hnode));
+#endif
 
-// compression functions
+	// inserting node in chain of the newer level
+	int linked = ref_cas(
+			current_valid,
+			&expect,
+			cnode,
+			memory_order_acq_rel,
+			memory_order_consume);
+#if LFHT_FILTERS
+	filter_end(hash, hnode);
+#endif
+	if(!linked) {
+		// insertion failed
+		goto start;
+	}
+	if(expect == hnode && current_valid == get_atomic_bucket(hash, hnode)) {
+		count_bucket(hnode, 1);
+	}
+	return 1;
+}
 
-int compress(
+// finds the tail of the bucket of cnode in *hnode for adjust_node().
+// the target of a merge is reached by lookups from the first bucket
+// merged on, so unlike a new level its chain is walked under the
+// merge record of the thread, whose fixed slots leave the chain of
+// the caller protected: the level goes in slot 0 and the last two
+// leaves in slots 1 and 2 (slot 3 is the level of lookup())
+//
+// returns: 1 if cnode already is in the bucket, or the level is being
+// compressed, which it cannot be before cnode moved there
+int merge_tail(
 		struct lfht_head *lfht,
 		int thread_id,
+		struct lfht_node *cnode,
+		size_t hash,
 		struct lfht_node **hnode,
-		size_t hash)
+		_Atomic(lfht_ref) **tail,
+		struct lfht_node **expect)
 {
-	HpRecord* hp = lfht->hazard_pointers[thread_id];
-
 #if LFHT_STATS
 	struct lfht_stats* stats = lfht->stats[thread_id];
-	stats->operations++;
 #endif
+	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	HpRecord* mhp = lfht->merge_hazard_pointers[thread_id];
 
 start: ;
+	hp_set(lfht->dom, mhp, *hnode, 0);
 
-#if LFHT_STATS
-	stats->max_retry_counter++;
-#endif
-
-	struct lfht_node *target = *hnode;
-
-	struct lfht_node *prev_hash = atomic_load_explicit(
-			&(target->hash.prev),
+	_Atomic(lfht_ref) *bucket = get_atomic_bucket(hash, *hnode);
+	_Atomic(lfht_ref) *prev = bucket;
+	struct lfht_node *iter = ref_load(
+			prev,
 			memory_order_consume);
+	unsigned slot = 1;
 
-	if(prev_hash == NULL || !is_empty(target)) {
-		// we cannot compress the root hash or a non empty hash
-		return 0;
-	}
-
-	struct lfht_node *freeze = create_freeze_node(target);
-	stats->memory_alloc += sizeof(*freeze);
-	struct lfht_node *expect;
-
-	// get_prev() tries to protect the previous hash node
-	prev_hash = get_prev(lfht, thread_id, target);
-
-	_Atomic(struct lfht_node *) *atomic_bucket =
-		get_atomic_bucket(hash, prev_hash);
-
-	// try to place freeze node in front of bucket,
-	// pointing to target hash
-	expect = target;
-	if(!atomic_compare_exchange_strong_explicit(
-				atomic_bucket,
-				&expect,
-				freeze,
-				memory_order_acq_rel,
-				memory_order_consume)) {
-		stats->memory_free += sizeof(*freeze);
-		free(freeze);
-
-		hp_protect(dom, hp, expect);
-		if(expect != atomic_load_explicit(
-					atomic_bucket,
-					memory_order_consume)) {
+	while(1) {
+		hp_set(lfht->dom, mhp, iter, slot);
+		if(iter != ref_load(
+					prev,
+					memory_order_seq_cst)) {
 			goto start;
 		}
 
-		if(!is_compression_node(expect)) {
+		if(iter->type != LEAF) {
+			break;
+		}
+
+		if(iter == cnode) {
+			// already inserted
 			return 1;
 		}
 
-		// aid compression
-		freeze = expect;
-	}
-#if LFHT_STATS
-	else {
-		stats->freeze_counter++;
-	}
-#endif
+		struct lfht_node *nxt_iter = get_next(iter);
 
-	// freeze empty buckets
-	for(int i = 0; i < (1<<target->hash.size); i++) {
-		_Atomic(struct lfht_node *) *nxt_atomic_bucket =
-			&(target->hash.array[i]);
+		if(is_invalid(nxt_iter) && moved_on(*hnode, nxt_iter)) {
+			// the level expanded since, as below
+			hp_set(lfht->dom, mhp, valid_ptr(nxt_iter), 3 - slot);
+			if(get_next(iter) != nxt_iter) {
+				goto start;
+			}
+			*hnode = valid_ptr(nxt_iter);
+			goto start;
+		}
 
-		expect = target;
-		if(!atomic_compare_exchange_strong_explicit(
-					nxt_atomic_bucket,
-					&expect,
-					freeze,
-					memory_order_acq_rel,
-					memory_order_consume) && expect != freeze) {
-			// bucket not empty
-			abort_compress(lfht, thread_id, target, freeze, freeze, atomic_bucket);
+		if(is_invalid(nxt_iter)) {
+			// detach iter, as lookup() does, the walk cannot
+			// go on from a node that may be detached already
+			struct lfht_node *detach = iter;
+			if(ref_cas(
+						prev,
+						&detach,
+						valid_ptr(nxt_iter),
+						memory_order_acq_rel,
+						memory_order_consume)) {
+				stats->memory_free += node_size(lfht, iter);
+				hp_retire(lfht->dom, thread_id, hp, iter);
+				if(prev == bucket && valid_ptr(nxt_iter) == *hnode) {
+					count_bucket(*hnode, -1);
+				}
+			}
 			goto start;
 		}
-	}
 
-	// this prevents the parent hash node from being referenced
-	// after it has been reclaimed
-	atomic_store_explicit(
-			&(target->hash.prev),
-			NULL,
-			memory_order_seq_cst);
+		prev = &(iter->leaf.next);
+		iter = nxt_iter;
+		slot = 3 - slot;
+	}
 
-	// removing hash from the trie (commit)
-	expect = freeze;
-	if(atomic_compare_exchange_strong_explicit(
-				atomic_bucket,
-				&expect,
-				prev_hash,
-				memory_order_acq_rel,
-				memory_order_consume)) {
-		// this thread was the one to commit compression
-		// it is responsible for freeing memory
-		stats->memory_free += sizeof(*freeze);
-		stats->memory_free += sizeof(*target);
-		hp_retire(dom, thread_id, hp, freeze);
-		hp_retire(dom, thread_id, hp, target);
+	if(iter == *hnode) {
+		*tail = prev;
+		*expect = iter;
+		return 0;
+	}
 
-#if LFHT_STATS
-		// compressed level
-		stats->compression_counter++;
-#endif
+	if(iter->type != HASH) {
+		return 1;
 	}
 
-	// try to compress previous level
-	*hnode = prev_hash;
+	// expanded since, already protected
+	*hnode = iter;
 	goto start;
 }
 
-// notify compressing thread to abort compression
-int unfreeze(
+// searching functions
+
+void *search_node(
 		struct lfht_head *lfht,
 		int thread_id,
-		struct lfht_node *target,
-		size_t hash)
+		struct lfht_node *hnode,
+		size_t hash,
+		const struct lfht_key *key)
 {
-#if LFHT_STATS
-	struct lfht_stats* stats = lfht->stats[thread_id];
-#endif
+	struct lfht_node *cnode;
 	HpRecord* hp = lfht->hazard_pointers[thread_id];
-
-	_Atomic(struct lfht_node *) *atomic_bucket =
-		get_atomic_bucket(hash, target->hash.prev);
-
-	struct lfht_node *head = atomic_load_explicit(
-			atomic_bucket,
-			memory_order_consume);
-
-	if(head == target) {
-		// compression rolled back successfully
-		return 1;
+	if(!lookup(lfht, thread_id, hash, key, &hnode, &cnode, NULL)) {
+		return NULL;
 	}
 
-	if(head->type == UNFREEZE) {
-		return get_next(head) == target;
-	}
+	void* result = atomic_load_explicit(
+			&(cnode->leaf.value),
+			memory_order_consume);
 
-	if(head->type != FREEZE || get_next(head) != target) {
-		// level already removed
-		return 0;
-	}
+	return result == REMOVED ? NULL : result;
+}
 
-	// head is freeze node
+// read-only version of lookup() that visits one node per call
+// anything that needs helping (invalid nodes, compression or
+// expansion) is left to search_node()
+//
+// returns: 1 once values[slot->index] is set
+int batch_step(
+		struct lfht_head *lfht,
+		int thread_id,
+		HpRecord *hp,
+		struct lfht_batch_slot *slot,
+		size_t hash,
+		void **values)
+{
+	struct lfht_node *iter;
 
-	struct lfht_node *unfreeze = create_unfreeze_node(target);
-	stats->memory_alloc += sizeof(*unfreeze);
-	hp_protect(dom, hp, unfreeze);
+	if(slot->bucket) {
+		// load bucket entry
+		iter = ref_load(
+				slot->bucket,
+				memory_order_consume);
 
-	// try to place unfreeze node in front of bucket,
-	// pointing to freeze node
-	if(!atomic_compare_exchange_strong_explicit(
-				atomic_bucket,
-				&head,
-				unfreeze,
-				memory_order_acq_rel,
-				memory_order_consume)) {
-		// already compressed, unfrozen or removed
-		stats->memory_free += sizeof(*unfreeze);
-		free(unfreeze);
+		hp_protect(lfht->dom, hp, iter);
+		if(iter != ref_load(
+					slot->bucket,
+					memory_order_consume) ||
+				is_compressed(slot->hnode) ||
+				is_compression_node(iter)) {
+			goto fallback;
+		}
 
-		if(head == target) {
-			// compression rolled back successfully
+		slot->bucket = NULL;
+		if(iter == slot->hnode) {
+			// empty bucket
+			values[slot->index] = NULL;
 			return 1;
 		}
 
-		if(head->type == UNFREEZE) {
-			return get_next(head) == target;
+#if LFHT_FILTERS
+		uint64_t filter = atomic_load_explicit(
+				get_filter(hash, slot->hnode),
+				memory_order_seq_cst);
+
+		if(iter->type == LEAF &&
+				!(filter & (filter_bit(hash, slot->hnode) | FILTER_EXPANDED))) {
+			// miss, the chain need not be walked
+			values[slot->index] = NULL;
+			return 1;
 		}
+#endif
 
+		slot->iter = iter;
+		__builtin_prefetch(iter);
 		return 0;
 	}
 
-	// we removed the freeze node, so we should retire it
-	stats->memory_free += sizeof(*head);
-	hp_retire(dom, thread_id, hp, head);
-
-#if LFHT_STATS
-	stats = atomic_load_explicit(&(lfht->stats[thread_id]), memory_order_relaxed);
-	stats->unfreeze_counter++;
-#endif
-	return 1;
-}
-
-// target -> hash level we wanted to compress
-// atomic_bucket -> atomic object of the previous level
-//   bucket pointing to our target
-void abort_compress(
-		struct lfht_head *lfht,
-		int thread_id,
-		struct lfht_node *target,
-		struct lfht_node *freeze,
-		struct lfht_node *head,
-		_Atomic(struct lfht_node *) *atomic_bucket)
-{
+	iter = slot->iter;
 #if LFHT_STATS
-	struct lfht_stats* stats = atomic_load_explicit(&(lfht->stats[thread_id]), memory_order_relaxed);
+	lfht->stats[thread_id]->paths++;
 #endif
-	HpRecord* hp = lfht->hazard_pointers[thread_id];
 
-	struct lfht_node *expect;
+	if(iter->type == HASH) {
+		// onto next tree level
+		slot->hnode = iter;
+		slot->bucket = get_atomic_bucket(hash, iter);
+		__builtin_prefetch(slot->bucket);
+		return 0;
+	}
 
-	// point all buckets to target
-	for(int i = 0; i < (1<<target->hash.size); i++) {
-		_Atomic(struct lfht_node *) *nxt_atomic_bucket = &(target->hash.array[i]);
-		expect = freeze;
+	struct lfht_node *nxt = get_next(iter);
+	if(is_invalid(nxt)) {
+		goto fallback;
+	}
 
-		// ignoring CAS failure
-		// just making sure all buckets point to target
-		// if it fails, they already do point to target or have a chain
-		atomic_compare_exchange_strong_explicit(
-				nxt_atomic_bucket,
-				&expect,
-				target,
-				memory_order_acq_rel,
+	if(leaf_match(lfht, iter, hash, NULL)) {
+		void *result = atomic_load_explicit(
+				&(iter->leaf.value),
 				memory_order_consume);
+
+		values[slot->index] = result == REMOVED ? NULL : result;
+		return 1;
 	}
 
-	// commit level by removing compression bridge node
-	if(atomic_compare_exchange_strong_explicit(
-			atomic_bucket,
-			&head,
-			target,
-			memory_order_acq_rel,
-			memory_order_consume)) {
-		// retire compression node
-		stats->memory_free += sizeof(*head);
-		hp_retire(dom, thread_id, hp, head);
+	if(lfht->sorted_chains && leaf_after(slot->hnode, iter, hash)) {
+		// passed the place of hash in the chain
+		values[slot->index] = NULL;
+		return 1;
 	}
 
-#if LFHT_STATS
-	stats = atomic_load_explicit(&(lfht->stats[thread_id]), memory_order_relaxed);
-	stats->compression_rollback_counter++;
-#endif
-}
+	hp_protect(lfht->dom, hp, nxt);
+	if(nxt != get_next(iter)) {
+		goto fallback;
+	}
 
-// expansion functions
+	if(nxt == slot->hnode) {
+		// end of chain
+		values[slot->index] = NULL;
+		return 1;
+	}
 
-int help_expansion(
-		struct lfht_head *lfht,
-		int thread_id,
-		struct lfht_node *hnode,
-		struct lfht_node *target,
-		size_t hash)
-{
-	if(target->type != HASH || target == hnode) {
-		return 0;
+	if(nxt->type == HASH) {
+		// expansion detected
+		goto fallback;
 	}
 
-	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	slot->iter = nxt;
+	__builtin_prefetch(nxt);
+	return 0;
 
-	// recursive helping
-	int pos = get_bucket_index(
+fallback:
+	// slot->hnode is still protected by the slot
+	values[slot->index] = search_node(
+			lfht,
+			thread_id,
+			slot->hnode,
 			hash,
-			hnode->hash.hash_pos,
-			hnode->hash.size);
+			NULL);
+	return 1;
+}
 
-	// move all nodes of chain to new level
-	_Atomic(struct lfht_node *) *parent_bucket =
-		&(hnode->hash.array[pos]);
+// bulk loading functions
+//
+// keys are radix partitioned by root bucket in parallel, then each
+// thread claims root buckets and builds their subtrees privately,
+// partitioning the keys of a bucket again whenever they would not
+// fit in one chain. a finished subtree is published with a single
+// CAS on its (empty) root bucket.
 
-	struct lfht_node *head = atomic_load_explicit(
-			parent_bucket,
-			memory_order_consume);
+void lfht_bulk_load(
+		struct lfht_head *lfht,
+		const size_t *hashes,
+		void **values,
+		size_t n,
+		int nthreads)
+{
+	// the subtrees would keep the root from growing, it takes the
+	// width the keys need first
+	struct lfht_node *root = lfht->entry_hash;
+	while(root->hash.size < lfht->max_root_hash_size &&
+			((size_t) lfht->max_chain_nodes << root->hash.size) < n) {
+		grow_root(lfht, 0, root);
+		root = lfht->entry_hash;
+	}
+	lfht->max_root_hash_size = root->hash.size;
+
+	size_t buckets = (size_t) 1 << root->hash.size;
+
+	struct lfht_bulk bulk;
+	bulk.lfht = lfht;
+	bulk.hashes = hashes;
+	bulk.values = values;
+	bulk.n = n;
+	bulk.nthreads = nthreads;
+	bulk.order = malloc(n * sizeof(size_t));
+	bulk.scratch = malloc(n * sizeof(size_t));
+	bulk.offsets = calloc(nthreads * buckets, sizeof(size_t));
+	bulk.start = malloc((buckets + 1) * sizeof(size_t));
+	atomic_init(&(bulk.next_bucket), 0);
+	pthread_barrier_init(&(bulk.barrier), NULL, nthreads);
+
+	pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+	struct lfht_bulk_thread *args = malloc(nthreads * sizeof(struct lfht_bulk_thread));
+	for(int i = 0; i < nthreads; i++) {
+		args[i].bulk = &bulk;
+		args[i].thread_id = i;
+		pthread_create(&threads[i], NULL, bulk_load_thread, &args[i]);
+	}
+	for(int i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
 
-	// check if expansion has terminated
-	if(head == target) {
-		return 1;
+	pthread_barrier_destroy(&(bulk.barrier));
+	free(threads);
+	free(args);
+	free(bulk.order);
+	free(bulk.scratch);
+	free(bulk.offsets);
+	free(bulk.start);
+}
+
+void *bulk_load_thread(void *arg)
+{
+	struct lfht_bulk *bulk = ((struct lfht_bulk_thread *) arg)->bulk;
+	int thread_id = ((struct lfht_bulk_thread *) arg)->thread_id;
+	struct lfht_head *lfht = bulk->lfht;
+	struct lfht_node *root = lfht->entry_hash;
+	size_t buckets = (size_t) 1 << root->hash.size;
+	size_t *offsets = &(bulk->offsets[thread_id * buckets]);
+
+	size_t from = bulk->n * thread_id / bulk->nthreads;
+	size_t to = bulk->n * (thread_id + 1) / bulk->nthreads;
+
+	// histogram of this thread's share of the keys
+	for(size_t i = from; i < to; i++) {
+		offsets[get_bucket_index(bulk->hashes[i], 0, root->hash.size)]++;
 	}
 
-	// check if new hash node has been compressed
-	if(is_compressed(target)) {
-		return 0;
+	pthread_barrier_wait(&(bulk->barrier));
+
+	if(thread_id == 0) {
+		// bucket by bucket, thread by thread
+		size_t sum = 0;
+		for(size_t b = 0; b < buckets; b++) {
+			bulk->start[b] = sum;
+			for(int t = 0; t < bulk->nthreads; t++) {
+				size_t count = bulk->offsets[t * buckets + b];
+				bulk->offsets[t * buckets + b] = sum;
+				sum += count;
+			}
+		}
+		bulk->start[buckets] = sum;
+	}
+
+	pthread_barrier_wait(&(bulk->barrier));
+
+	for(size_t i = from; i < to; i++) {
+		bulk->order[offsets[get_bucket_index(bulk->hashes[i], 0, root->hash.size)]++] = i;
 	}
 
-	adjust_chain_nodes(
-			lfht,
-			thread_id,
-			target,
-			head);
+	pthread_barrier_wait(&(bulk->barrier));
+
+	// claim root buckets a few at a time
+	const size_t claim = 64;
+	size_t first;
+	while((first = atomic_fetch_add_explicit(
+					&(bulk->next_bucket),
+					claim,
+					memory_order_relaxed)) < buckets) {
+		for(size_t b = first; b < first + claim && b < buckets; b++) {
+			size_t *keys = &(bulk->order[bulk->start[b]]);
+			size_t count = bulk->start[b+1] - bulk->start[b];
+			if(count == 0) {
+				continue;
+			}
 
-	int res = atomic_compare_exchange_strong_explicit(
-			parent_bucket,
-			&head,
-			target,
-			memory_order_acq_rel,
-			memory_order_consume);
+			// the levels below tell keys apart by their hashes,
+			// which partitions of the same keys cannot
+			count = bulk_dedupe(bulk, keys, &(bulk->scratch[bulk->start[b]]), count);
+
+			struct lfht_node *expect = root;
+			if(ref_load(
+						&(root->hash.array[b]),
+						memory_order_consume) == root) {
+				struct lfht_node *subtree = bulk_build(
+						bulk,
+						thread_id,
+						root,
+						keys,
+						&(bulk->scratch[bulk->start[b]]),
+						count);
+
+#if LFHT_FILTERS
+				uint64_t bits = 0;
+				for(struct lfht_node *iter = subtree;
+						iter->type == LEAF;
+						iter = get_next(iter)) {
+					bits |= filter_bit(leaf_hash(iter, b), root);
+				}
+				filter_begin(b, root, bits);
+#endif
+				int published = ref_cas(
+						&(root->hash.array[b]),
+						&expect,
+						subtree,
+						memory_order_acq_rel,
+						memory_order_consume);
+#if LFHT_FILTERS
+				filter_end(b, root);
+#endif
+				if(published) {
+					count_bucket(root, 1);
+					continue;
+				}
 
-#if LFHT_STATS
-	if(res) {
-		struct lfht_stats* stats = atomic_load_explicit(&(lfht->stats[thread_id]), memory_order_relaxed);
-		stats->expansion_counter++;
-		int level = target->hash.hash_pos / target->hash.size;
-		if(stats->max_depth < level) {
-			stats->max_depth = level;
+				// bucket filled concurrently
+				bulk_free(lfht, thread_id, subtree, root);
+			}
+
+			for(size_t i = 0; i < count; i++) {
+				search_insert(
+						lfht,
+						thread_id,
+						root,
+						bulk->hashes[keys[i]],
+						NULL,
+						bulk->values[keys[i]],
+						0,
+						NULL);
+			}
 		}
 	}
-#endif
 
-	return res;
+	return NULL;
 }
 
-int expand(
-		struct lfht_head *lfht,
+// builds the contents of a bucket of hnode, the keys are partitioned
+// through scratch when they do not fit in a chain, i.e. when
+// search_insert() would have expanded it
+//
+// returns: first node of the bucket
+struct lfht_node *bulk_build(
+		struct lfht_bulk *bulk,
 		int thread_id,
-		struct lfht_node **new_hash,
 		struct lfht_node *hnode,
-		size_t hash,
-		_Atomic(struct lfht_node *) *tail_nxt_ptr)
+		size_t *keys,
+		size_t *scratch,
+		size_t count)
 {
+	struct lfht_head *lfht = bulk->lfht;
+	int hash_pos = hnode->hash.hash_pos + hnode->hash.size;
+
+	if(count <= lfht->max_chain_nodes ||
+			hash_pos + lfht->min_hash_size > (int) (8 * sizeof(size_t))) {
+		struct lfht_node *head = hnode;
+		size_t added = 0;
+
+		if(lfht->sorted_chains) {
+			// leaves are prepended, so they are created in the
+			// reverse order of the chain
+			for(size_t i = 1; i < count; i++) {
+				size_t key = keys[i];
+				size_t j = i;
+
+				while(j > 0 && (hnode->hash.reversed ?
+							bulk->hashes[keys[j-1]] > bulk->hashes[key] :
+							bulk->hashes[keys[j-1]] < bulk->hashes[key])) {
+					keys[j] = keys[j-1];
+					j--;
+				}
+				keys[j] = key;
+			}
+		}
+
+		// keys are distinct (see bulk_dedupe())
+		for(size_t i = 0; i < count; i++) {
+			size_t hash = bulk->hashes[keys[i]];
+
+			head = create_leaf_node(
+					lfht,
+					thread_id,
+					hash,
+					NULL,
+					bulk->values[keys[i]],
+					head);
+			added++;
 #if LFHT_STATS
-	struct lfht_stats* stats = lfht->stats[thread_id];
+			lfht->stats[thread_id]->memory_alloc += node_size(lfht, head);
 #endif
-	HpRecord* hp = lfht->hazard_pointers[thread_id];
+#if LFHT_FILTERS
+			// root buckets get theirs once published
+			if(hnode != lfht->entry_hash) {
+				atomic_fetch_or_explicit(
+						get_filter(hash, hnode),
+						filter_bit(hash, hnode),
+						memory_order_relaxed);
+			}
+#endif
+		}
 
-	struct lfht_node *exp = hnode;
+		add_size(lfht, thread_id, added);
+		return head;
+	}
 
-	*new_hash = create_hash_node(
-			lfht->hash_size,
-			hnode->hash.hash_pos + hnode->hash.size,
+	size_t diff = 0;
+	for(size_t i = 1; i < count; i++) {
+		diff |= bulk->hashes[keys[i]] ^ bulk->hashes[keys[0]];
+	}
+
+	struct lfht_node *new_hash = create_hash_node(
+			lfht,
+			thread_id,
+			expansion_size(lfht, hnode, diff, count),
+			hash_pos,
 			hnode);
-	stats->memory_alloc += sizeof(**new_hash);
 
-	hp_protect(dom, hp, *new_hash);
+	int size = new_hash->hash.size;
+	size_t start[(1 << size) + 1];
+	for(int b = 0; b <= 1 << size; b++) {
+		start[b] = 0;
+	}
 
-	// add new hash level to tail of chain
-	if(atomic_compare_exchange_strong_explicit(
-				tail_nxt_ptr,
-				&exp,
-				*new_hash,
-				memory_order_acq_rel,
-				memory_order_consume)) {
-		return help_expansion(
-				lfht,
-				thread_id,
-				hnode,
-				*new_hash,
-				hash);
+	for(size_t i = 0; i < count; i++) {
+		start[get_bucket_index(bulk->hashes[keys[i]], hash_pos, size) + 1]++;
+	}
+	for(int b = 0; b < 1 << size; b++) {
+		start[b+1] += start[b];
+	}
+	for(size_t i = 0; i < count; i++) {
+		scratch[start[get_bucket_index(bulk->hashes[keys[i]], hash_pos, size)]++] = keys[i];
 	}
 
-	// failed
-	stats->memory_free += sizeof(**new_hash);
-	free(*new_hash);
+	// start[b] now holds the end of bucket b
+	size_t first = 0;
+	for(int b = 0; b < 1 << size; b++) {
+		if(start[b] > first) {
+			count_bucket(new_hash, 1);
+			ref_init(&(new_hash->hash.array[b]), bulk_build(
+						bulk,
+						thread_id,
+						new_hash,
+						&(scratch[first]),
+						&(keys[first]),
+						start[b] - first));
+		}
+		first = start[b];
+	}
 
-	// protect new hash node
-	hp_protect(dom, hp, exp);
-	struct lfht_node* tail = atomic_load_explicit(
-			tail_nxt_ptr,
-			memory_order_consume);
+	return new_hash;
+}
 
-	if(tail != exp || exp->type != HASH || exp == hnode) {
-		return 0;
+// sorts the keys of a root bucket by hash through scratch and keeps
+// the first of each hash, the sort is stable so the first value of
+// duplicate keys wins, as it would with search_insert()
+//
+// returns: number of keys left
+size_t bulk_dedupe(
+		struct lfht_bulk *bulk,
+		size_t *keys,
+		size_t *scratch,
+		size_t count)
+{
+	const size_t *hashes = bulk->hashes;
+	size_t *from = keys;
+	size_t *to = scratch;
+
+	// bottom up merge sort
+	for(size_t width = 1; width < count; width *= 2) {
+		for(size_t lo = 0; lo < count; lo += 2 * width) {
+			size_t mid = lo + width < count ? lo + width : count;
+			size_t hi = mid + width < count ? mid + width : count;
+			size_t i = lo;
+			size_t j = mid;
+			size_t k = lo;
+
+			while(i < mid && j < hi) {
+				if(hashes[from[j]] < hashes[from[i]]) {
+					to[k++] = from[j++];
+				} else {
+					to[k++] = from[i++];
+				}
+			}
+			while(i < mid) {
+				to[k++] = from[i++];
+			}
+			while(j < hi) {
+				to[k++] = from[j++];
+			}
+		}
+
+		size_t *sorted = to;
+		to = from;
+		from = sorted;
 	}
 
-	*new_hash = exp;
+	// from may be keys, which is never written ahead of i
+	size_t left = 0;
+	for(size_t i = 0; i < count; i++) {
+		if(left == 0 || hashes[from[i]] != hashes[keys[left - 1]]) {
+			keys[left++] = from[i];
+		}
+	}
 
-	return help_expansion(
-			lfht,
-			thread_id,
-			hnode,
-			exp,
-			hash);
+	return left;
 }
 
-int adjust_chain_nodes(
+// frees a subtree that was never published
+void bulk_free(
 		struct lfht_head *lfht,
 		int thread_id,
-		struct lfht_node *hnode,
-		struct lfht_node *iter)
+		struct lfht_node *node,
+		struct lfht_node *hnode)
 {
-	HpRecord* hp = lfht->hazard_pointers[thread_id];
+	while(node != hnode) {
+		struct lfht_node *nxt;
 
-	if(iter->type != LEAF) {
-		// reached tail
-		return iter == hnode;
+		if(node->type == HASH) {
+			for(int b = 0; b < 1 << node->hash.size; b++) {
+				bulk_free(lfht, thread_id, from_ref(node->hash.array[b]), node);
+			}
+			nxt = hnode;
+		} else {
+			add_size(lfht, thread_id, -1);
+#if LFHT_STATS
+			lfht->stats[thread_id]->memory_free += node_size(lfht, node);
+#endif
+			nxt = get_next(node);
+		}
+
+		node_free(lfht, thread_id, node);
+		node = nxt;
 	}
+}
 
-	struct lfht_node *nxt_iter = get_next(iter);
-	struct lfht_node *nxt = valid_ptr(nxt_iter);
+// size functions
 
-	if(!adjust_chain_nodes(
-			lfht,
-			thread_id,
-			hnode,
-			nxt)) {
-		// not the hash we wished to expand
-		return 0;
+void add_size(
+		struct lfht_head *lfht,
+		int thread_id,
+		long delta)
+{
+	_Atomic(long) *slot;
+
+	if(lfht->lean) {
+		// a padded slot per thread would outweigh the table, so the
+		// counter shares a cache line with nodes of the same thread
+		slot = atomic_load_explicit(
+				&(lfht->lean_sizes[thread_id]),
+				memory_order_relaxed);
+		if(!slot) {
+			slot = node_alloc(lfht, thread_id, LEAF_CLASS);
+			atomic_init(slot, 0);
+			atomic_store_explicit(
+					&(lfht->lean_sizes[thread_id]),
+					slot,
+					memory_order_release);
+		}
+	} else {
+		slot = &(lfht->sizes[thread_id].delta);
 	}
 
-	if(is_invalid(nxt_iter)) {
-		// skip invalid nodes
-		return 1;
+	// no RMW, the slot has a single writer
+	atomic_store_explicit(
+			slot,
+			atomic_load_explicit(slot, memory_order_relaxed) + delta,
+			memory_order_relaxed);
+}
+
+size_t lfht_size_approx(struct lfht_head *lfht)
+{
+	long size = 0;
+	for(int i = 0; i < lfht->max_threads; i++) {
+		_Atomic(long) *slot;
+		if(lfht->lean) {
+			slot = atomic_load_explicit(
+					&(lfht->lean_sizes[i]),
+					memory_order_acquire);
+			if(!slot) {
+				continue;
+			}
+		} else {
+			slot = &(lfht->sizes[i].delta);
+		}
+		size += atomic_load_explicit(slot, memory_order_relaxed);
 	}
 
-	// iter is valid
-	adjust_node(lfht, thread_id, iter, nxt_iter, hnode);
-	return 1;
+	// removals may be seen before the insertions they undo
+	return size > 0 ? size : 0;
 }
 
-void adjust_node(
+// a bucket reached through <bits> hash bits holds 1/2^bits of the
+// hash space, so its leaf count times 2^bits estimates the size.
+// samples are spread evenly over the bit-reversed order, i.e. over
+// every subtree of the trie
+size_t lfht_size_sampled(
 		struct lfht_head *lfht,
-		int thread_id,
-		struct lfht_node *cnode,
-		struct lfht_node *nxt,
-		struct lfht_node *hnode)
+		int samples,
+		int thread_id)
 {
-#if LFHT_STATS
-	struct lfht_stats* stats = lfht->stats[thread_id];
-	stats->operations++;
-#endif
+	struct lfht_iter iter;
+	lfht_iter_begin(lfht, &iter, thread_id);
 
-start: ;
-
-#if LFHT_STATS
-	stats->max_retry_counter++;
-#endif
+	if(samples < 1) {
+		samples = 1;
+	}
 
-	unsigned int count = 0;
-	size_t hash = cnode->leaf.hash;
+	size_t step = SIZE_MAX / samples;
+	double size = 0;
+	for(int i = 0; i < samples; i++) {
+		size_t hash = reverse_bits(i * step + step / 2);
+		size_t end;
+		int bits;
+		while(!iter_snapshot(&iter, hash, &end, &bits));
 
-	_Atomic(struct lfht_node *) *current_valid =
-		get_atomic_bucket(hash, hnode);
+		size += iter.count * (bits >= (int) (8 * sizeof(size_t)) ?
+				1.0 * SIZE_MAX : (double) ((size_t) 1 << bits));
+	}
 
-	struct lfht_node *expect = valid_ptr(atomic_load_explicit(
-				current_valid,
-				memory_order_consume));
+	lfht_iter_end(&iter);
+	return size / samples;
+}
 
-	struct lfht_node *iter = expect;
+// iteration functions
+//
+// entries are visited in bit-reversed hash order, as hash bits are
+// consumed from the least significant one, every bucket of the trie
+// holds a contiguous range of that order, whatever the level it
+// sits on. the iterator snapshots one bucket at a time and keeps a
+// cursor past the range of the last snapshot, so expansions and
+// compressions never make it revisit or skip a range.
+
+void lfht_iter_begin(
+		struct lfht_head *lfht,
+		struct lfht_iter *iter,
+		int thread_id)
+{
+	iter->head = lfht;
+	iter->thread_id = thread_id;
+	iter->cursor = 0;
+	iter->last = SIZE_MAX;
+	iter->done = 0;
+	iter->count = 0;
+	iter->next = 0;
+	iter->capacity = lfht->max_chain_nodes + 1;
+	iter->entries = (struct lfht_entry *)
+		malloc(iter->capacity * sizeof(struct lfht_entry));
+}
 
-	// find tail of target bucket on new hash level
-	while(iter->type == LEAF) {
-		struct lfht_node *nxt_ptr = get_next(iter);
+int lfht_iter_next(
+		struct lfht_iter *iter,
+		struct lfht_entry *entry)
+{
+	while(iter->next >= iter->count) {
+		if(iter->done) {
+			return 0;
+		}
 
-		if(is_invalid(nxt_ptr)) {
-			// skip invalid node
-			iter = valid_ptr(nxt_ptr);
+		size_t end;
+		int bits;
+		if(!iter_snapshot(iter, reverse_bits(iter->cursor), &end, &bits)) {
+			// helped a concurrent operation, retry
 			continue;
 		}
 
-		if(cnode == iter) {
-			// already inserted
-			return;
+		iter->next = 0;
+		if(end == 0 || end - 1 >= iter->last) {
+			// last range of the hash space
+			iter->done = 1;
 		}
-
-		current_valid = &(iter->leaf.next);
-		expect = valid_ptr(nxt_ptr);
-		iter = expect;
-		count++;
+		iter->cursor = end;
 	}
 
-	if(iter != hnode) {
-		hnode = iter;
-		goto start;
-	}
+	*entry = iter->entries[iter->next++];
+	return 1;
+}
 
-	// point node to newer level
-	if(!atomic_compare_exchange_strong_explicit(
-				&(cnode->leaf.next),
-				&nxt,
-				hnode,
-				memory_order_acq_rel,
-				memory_order_consume) && is_invalid(get_next(cnode))) {
+// hashes sharing their prefix_bits least significant bits are a
+// single range of the bit-reversed order, the first snapshot
+// descends straight to the subtree holding it
+void lfht_iter_begin_prefix(
+		struct lfht_head *lfht,
+		struct lfht_iter *iter,
+		size_t prefix,
+		int prefix_bits,
+		int thread_id)
+{
+	lfht_iter_begin(lfht, iter, thread_id);
+
+	if(prefix_bits <= 0) {
 		return;
 	}
 
-	// inserting node in chain of the newer level
-	if(!atomic_compare_exchange_strong_explicit(
-				current_valid,
-				&expect,
-				cnode,
-				memory_order_acq_rel,
-				memory_order_consume)) {
-		// insertion failed
-		goto start;
+	int bits = 8 * sizeof(size_t);
+	if(prefix_bits < bits) {
+		prefix &= ((size_t) 1 << prefix_bits) - 1;
 	}
-}
 
-// searching functions
+	iter->cursor = reverse_bits(prefix);
+	iter->last = prefix_bits < bits ?
+		iter->cursor + (((size_t) 1 << (bits - prefix_bits)) - 1) :
+		iter->cursor;
+}
 
-void *search_node(
+void lfht_scan_prefix(
 		struct lfht_head *lfht,
-		int thread_id,
-		struct lfht_node *hnode,
-		size_t hash)
+		size_t prefix,
+		int prefix_bits,
+		lfht_scan_fn callback,
+		void *ctx,
+		int thread_id)
 {
-	struct lfht_node *cnode;
+	struct lfht_iter iter;
+	struct lfht_entry entry;
+
+	lfht_iter_begin_prefix(lfht, &iter, prefix, prefix_bits, thread_id);
+	while(lfht_iter_next(&iter, &entry)) {
+		callback(&entry, ctx);
+	}
+	lfht_iter_end(&iter);
+}
+
+void lfht_iter_end(struct lfht_iter *iter)
+{
+	free(iter->entries);
+	iter->entries = NULL;
+	iter->count = 0;
+	iter->next = 0;
+	iter->done = 1;
+}
+
+size_t reverse_bits(size_t x)
+{
+	x = ((x >> 1) & 0x5555555555555555UL) | ((x & 0x5555555555555555UL) << 1);
+	x = ((x >> 2) & 0x3333333333333333UL) | ((x & 0x3333333333333333UL) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FUL) | ((x & 0x0F0F0F0F0F0F0F0FUL) << 4);
+	return __builtin_bswap64(x);
+}
+
+// copies the valid leaves of the bucket holding hash that are
+// between the cursor and the last position of the iterator,
+// sorted in bit-reversed order
+// end -> first position past the range of the bucket (0 on overflow)
+// bits -> hash bits consumed down to the bucket, a level shared by
+// the buckets of a merge in progress consumes none
+//
+// returns: 0 if the snapshot must be retried
+int iter_snapshot(
+		struct lfht_iter *iter,
+		size_t hash,
+		size_t *end,
+		int *bits)
+{
+	struct lfht_head *lfht = iter->head;
+	int thread_id = iter->thread_id;
 	HpRecord* hp = lfht->hazard_pointers[thread_id];
-	int found = lookup(lfht, thread_id, hash, &hnode, &cnode, NULL, NULL);
-	void* result = cnode->leaf.value;
+	struct lfht_node *hnode = lfht->entry_hash;
+
+	iter->count = 0;
+	*bits = 0;
 
-	if(found) {
-		return result;
+traversal: ;
+	if(*bits < hnode->hash.hash_pos + hnode->hash.size) {
+		*bits = hnode->hash.hash_pos + hnode->hash.size;
 	}
-	return NULL;
+
+	_Atomic(lfht_ref) *bucket = get_atomic_bucket(hash, hnode);
+	struct lfht_node *node = ref_load(
+			bucket,
+			memory_order_consume);
+
+	hp_protect(lfht->dom, hp, node);
+	if(node != ref_load(
+				bucket,
+				memory_order_consume) || is_compressed(hnode)) {
+		// node may be the retired freeze node of hnode (see lookup())
+		return 0;
+	}
+
+	if(node->type == HASH && node != hnode) {
+		// onto next tree level
+		hnode = node;
+		goto traversal;
+	}
+
+	size_t range = *bits >= (int) (8 * sizeof(size_t)) ?
+		1 : (size_t) 1 << (8 * sizeof(size_t) - *bits);
+	size_t start = reverse_bits(hash) & ~(range - 1);
+	*end = start + range;
+
+	while(node != hnode) {
+		if(node->type != LEAF) {
+			// compression in progress
+			goto help;
+		}
+
+		struct lfht_node *nxt = get_next(node);
+		if(is_invalid(nxt)) {
+			goto help;
+		}
+
+		size_t key = leaf_hash(node, hash);
+		void *value = atomic_load_explicit(
+				&(node->leaf.value),
+				memory_order_consume);
+
+		size_t pos = reverse_bits(key);
+		if(value != REMOVED && pos >= iter->cursor && pos <= iter->last &&
+				(pos & ~(range - 1)) == start) {
+			if(iter->count == iter->capacity) {
+				iter->capacity *= 2;
+				iter->entries = (struct lfht_entry *) realloc(
+						iter->entries,
+						iter->capacity * sizeof(struct lfht_entry));
+			}
+
+			// insertion sort, chains are short
+			int i = iter->count++;
+			for(; i > 0 && reverse_bits(iter->entries[i-1].hash) > pos; i--) {
+				iter->entries[i] = iter->entries[i-1];
+			}
+
+			struct lfht_entry *entry = &(iter->entries[i]);
+			entry->hash = key;
+			entry->value = value;
+			entry->key = lfht->key_eq ? node->leaf.key : NULL;
+			entry->key_len = lfht->key_eq ? node->leaf.key_len : 0;
+		}
+
+		hp_protect(lfht->dom, hp, nxt);
+		if(nxt != get_next(node)) {
+			iter->count = 0;
+			return 0;
+		}
+
+		if(nxt->type == HASH && nxt != hnode) {
+			// expansion detected
+			goto help;
+		}
+
+		node = nxt;
+	}
+
+	return 1;
+
+help:
+	// lookup() of a hash in the same bucket helps on its way
+	iter->count = 0;
+	search_node(lfht, thread_id, lfht->entry_hash, hash, NULL);
+	return 0;
 }
 
 #if HP_STATS
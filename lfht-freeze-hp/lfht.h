@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef LFHT_STATS
 #define LFHT_STATS 0
@@ -8,10 +9,51 @@
 #define LFHT_STATS 0
 #endif
 
+// leaves of 24 bytes (32 with LFHT_COMPACT_LEAVES=0), tables get
+// roots of at least 16 bits
+#ifndef LFHT_COMPACT_LEAVES
+#define LFHT_COMPACT_LEAVES 0
+#endif
+
+// 32 bit references between nodes instead of pointers, which halves
+// the buckets of hash nodes, up to 32GB of nodes per process (16GB
+// with LFHT_COMPACT_LEAVES)
+#ifndef LFHT_REFS
+#define LFHT_REFS 0
+#endif
+
+// a 64 bit filter word per bucket, lookups of missing keys skip most
+// of the chains: 12 bits of leaves, an expanded bit, 9 bits counting
+// pending links and a 42 bit version (see get_filter() in lfht.c)
+#ifndef LFHT_FILTERS
+#define LFHT_FILTERS 0
+#endif
+
+// lookups start from the last hash node reached by the thread for
+// hashes of the same prefix instead of the root
+#ifndef LFHT_JUMP_CACHE
+#define LFHT_JUMP_CACHE 1
+#endif
+
 #define MAX_NODES 3
 #define ROOT_HASH_SIZE 16
 #define HASH_SIZE 4
+#define MAX_HASH_SIZE 8
 #define CACHE_SIZE 64
+// traversals in flight in lfht_search_batch()
+#define BATCH_SLOTS 8
+// entries of the jump cache of each thread
+#define JUMP_SLOTS 256
+
+struct lfht_node;
+
+// reference to a node, as kept in buckets and in the prev and next
+// fields, 32 bit handles with LFHT_REFS (see to_ref() in lfht.c)
+#if LFHT_REFS
+typedef uint32_t lfht_ref;
+#else
+typedef struct lfht_node *lfht_ref;
+#endif
 
 #if LFHT_STATS
 #include <time.h>
@@ -33,17 +75,152 @@ struct lfht_stats {
 	unsigned long lookups;
 	unsigned long memory_alloc;
 	unsigned long memory_free;
+	unsigned long pool_hits;
+	unsigned long pool_misses;
+	unsigned long pool_remote_frees;
+	unsigned long dir_updates;
+	int deferred_compression_counter;
+	int avoided_compression_counter;
+	int merge_counter;
+	int root_growth_counter;
 	struct timespec term;
 };
 #endif
 
+// callbacks of tables with arbitrary keys
+// (see lfht_insert_key())
+typedef size_t (*lfht_hash_fn)(
+		const void *key,
+		size_t len);
+
+typedef int (*lfht_eq_fn)(
+		const void *k1,
+		size_t len1,
+		const void *k2,
+		size_t len2);
+
+// computes the new value of a key from its current value
+// (NULL if missing), returning NULL leaves the key removed
+// may run more than once under contention
+typedef void *(*lfht_compute_fn)(
+		void *value,
+		void *ctx);
+
+struct lfht_config {
+	int root_hash_size;
+	// lets the root double from root_hash_size bits up to
+	// max_root_hash_size as keys come (0: fixed width)
+	int max_root_hash_size;
+	int hash_size;
+	int max_chain_nodes;
+	// levels below the root are between hash_size and
+	// max_hash_size wide, depending on the keys they split
+	// (0: hash_size, MAX_HASH_SIZE is a sensible width otherwise)
+	int max_hash_size;
+	// lets levels that split few keys be narrower than hash_size,
+	// down to min_hash_size bits (0: hash_size)
+	int min_hash_size;
+	// keeps chains sorted by hash, lookups of missing keys stop
+	// halfway on average instead of at the end of the chain
+	int sorted_chains;
+	// lookups start from a directory of 2^dir_bits entries, each
+	// pointing to the deepest level its prefix leads to
+	// (0: no directory, otherwise at least root_hash_size)
+	int dir_bits;
+	// misses an empty level waits for before it is compressed,
+	// keys that come back meanwhile reuse it (0: compress at once)
+	int compress_delay;
+	// replaces levels left with fewer keys than max_chain_nodes by
+	// a single bucket level holding them in one chain
+	// (not with sorted_chains)
+	int merge_levels;
+	// shares the hazard pointers, node pools and stats of each thread
+	// with the other lean tables of the process instead of allocating
+	// its own, and keeps no jump cache. for many small tables, along
+	// with a small root_hash_size (see max_root_hash_size)
+	int lean;
+
+	// setting key_eq makes a keyed table: leaves keep a pointer
+	// to their key, which is compared once hashes match.
+	// keys are not copied and must outlive their entries.
+	// key_hash defaults to lfht_hash_bytes()
+	lfht_hash_fn key_hash;
+	lfht_eq_fn key_eq;
+};
+
+// entry returned by the iterator
+// key and key_len are only set on keyed tables
+struct lfht_entry {
+	size_t hash;
+	void *value;
+	const void *key;
+	size_t key_len;
+};
+
+// weakly consistent iterator
+// entries present during the whole iteration are returned exactly
+// once, entries inserted or removed meanwhile may or may not be.
+// entries are returned in bit-reversed hash order
+struct lfht_iter {
+	struct lfht_head *head;
+	int thread_id;
+	// every entry before the cursor was returned
+	// the iteration stops past last
+	size_t cursor;
+	size_t last;
+	int done;
+	// snapshot of the current bucket
+	struct lfht_entry *entries;
+	int count;
+	int next;
+	int capacity;
+};
+
 struct lfht_head {
-	struct lfht_node *entry_hash;
+	// the current root, replaced by a wider one as it grows
+	_Atomic(struct lfht_node *) entry_hash;
 	int max_threads;
+	// width of the first root
 	int root_hash_size;
+	// lowered to the width reached once the root stops growing
+	_Atomic(int) max_root_hash_size;
+	// first root, each one forwards to the next (see grow_root())
+	struct lfht_node *base_hash;
 	int hash_size;
+	int min_hash_size;
+	int max_hash_size;
 	unsigned int max_chain_nodes;
+	int sorted_chains;
+	int dir_bits;
+	// NULL unless dir_bits is set
+	_Atomic(lfht_ref) *dir;
+	int compress_delay;
+	int merge_levels;
+	// the per thread arrays are those of the process (see lean_share())
+	int lean;
+	lfht_hash_fn key_hash;
+	lfht_eq_fn key_eq;
+	// scans only go over the records of the table, or of every lean
+	// table as they share one domain
+	HpDomain* dom;
 	HpRecord** hazard_pointers;
+	HpRecord*** batch_hazard_pointers;
+	// NULL unless merge_levels is set (see merge_tail() and lookup())
+	HpRecord** merge_hazard_pointers;
+	struct lfht_pool **pools;
+	// NULL on lean tables
+	struct lfht_size *sizes;
+	// lean tables only, the counter of a thread is taken from its
+	// pool once it inserts or removes (see add_size())
+	_Atomic(_Atomic(long)*) *lean_sizes;
+#if LFHT_JUMP_CACHE
+	// NULL on lean tables
+	struct lfht_jump **jumps;
+	// bumped by every compression (see jump_get())
+	_Atomic(unsigned long) jump_epoch;
+	// hash bits that select an entry of the cache
+	int jump_bits;
+#endif
 #if LFHT_STATS
 	_Atomic(struct lfht_stats*) *stats;
 #endif
@@ -66,6 +243,14 @@ void lfht_reset_stats(struct lfht_head *lfht, int tid) {
 	s->max_depth = 0;
 	s->paths = 0;
 	s->lookups = 0;
+	s->pool_hits = 0;
+	s->pool_misses = 0;
+	s->pool_remote_frees = 0;
+	s->dir_updates = 0;
+	s->deferred_compression_counter = 0;
+	s->avoided_compression_counter = 0;
+	s->merge_counter = 0;
+	s->root_growth_counter = 0;
 }
 #endif
 
@@ -78,13 +263,29 @@ struct lfht_head *init_lfht_explicit(
 		int hash_size,
 		int max_chain_nodes);
 
+// fills config with the defaults of init_lfht()
+void lfht_default_config(struct lfht_config *config);
+
+// lean tables take max_threads, and at most max_chain_nodes, from the
+// first lean table of the process
+//
+// returns: NULL on a lean table asking for more threads than the first
+// one of the process
+struct lfht_head *init_lfht_config(
+		int max_threads,
+		struct lfht_config *config);
+
 // not thread safe
+// lean tables only give their nodes back, the other lean tables may
+// go on meanwhile
 void free_lfht(struct lfht_head *lfht);
 
+// on a lean table, sets the thread up for every lean table
 int lfht_init_thread(
 		struct lfht_head *head,
 		int thread_id);
 
+// leaves the thread set up on lean tables
 void lfht_end_thread(
 		struct lfht_head *head,
 		int thread_id);
@@ -94,17 +295,185 @@ void *lfht_search(
 		size_t hash,
 		int thread_id);
 
+// values[i] <- lfht_search(hashes[i]), for i < n
+// interleaves the traversals to overlap their cache misses
+// integer interface only
+void lfht_search_batch(
+		struct lfht_head *head,
+		const size_t *hashes,
+		void **values,
+		int n,
+		int thread_id);
+
 void lfht_insert(
 		struct lfht_head *head,
 		size_t hash,
 		void *value,
 		int thread_id);
 
+// replaces the value of hash in place, inserting it if missing
+// returns: previous value, NULL if inserted
+void *lfht_put(
+		struct lfht_head *head,
+		size_t hash,
+		void *value,
+		int thread_id);
+
+// returns: value already mapped to hash, NULL if inserted
+void *lfht_insert_if_absent(
+		struct lfht_head *head,
+		size_t hash,
+		void *value,
+		int thread_id);
+
+// returns: new value of hash
+void *lfht_compute(
+		struct lfht_head *head,
+		size_t hash,
+		lfht_compute_fn fn,
+		void *ctx,
+		int thread_id);
+
+// for integer values, missing keys start from 0
+// returns: previous value
+size_t lfht_fetch_add(
+		struct lfht_head *head,
+		size_t hash,
+		size_t delta,
+		int thread_id);
+
 void lfht_remove(
 		struct lfht_head *head,
 		size_t hash,
 		int thread_id);
 
+// bulk interface
+
+// inserts n keys (integer interface) using nthreads threads
+// with the ids 0 to nthreads-1, which must have been initialized
+// and must not be in use until it returns
+// keys of root buckets that are not empty are inserted one by one
+// a root that may grow is grown for the keys first and then keeps
+// its width, no insertion may run meanwhile
+void lfht_bulk_load(
+		struct lfht_head *head,
+		const size_t *hashes,
+		void **values,
+		size_t n,
+		int nthreads);
+
+// size interface
+
+// sums the inserts and removes of every thread
+// exact while no thread is inserting or removing
+size_t lfht_size_approx(struct lfht_head *head);
+
+// estimate from <samples> buckets, without a full walk
+size_t lfht_size_sampled(
+		struct lfht_head *head,
+		int samples,
+		int thread_id);
+
+// iterator interface
+// the thread must have been initialized, the iterator may be
+// interleaved with other operations of the same thread
+
+void lfht_iter_begin(
+		struct lfht_head *head,
+		struct lfht_iter *iter,
+		int thread_id);
+
+// returns: 0 once every entry was visited
+int lfht_iter_next(
+		struct lfht_iter *iter,
+		struct lfht_entry *entry);
+
+void lfht_iter_end(struct lfht_iter *iter);
+
+// only visits hashes whose prefix_bits least significant bits
+// match those of prefix, i.e. the subtree of the trie holding them
+void lfht_iter_begin_prefix(
+		struct lfht_head *head,
+		struct lfht_iter *iter,
+		size_t prefix,
+		int prefix_bits,
+		int thread_id);
+
+typedef void (*lfht_scan_fn)(
+		struct lfht_entry *entry,
+		void *ctx);
+
+// calls back every entry of lfht_iter_begin_prefix()
+void lfht_scan_prefix(
+		struct lfht_head *head,
+		size_t prefix,
+		int prefix_bits,
+		lfht_scan_fn callback,
+		void *ctx,
+		int thread_id);
+
+// keyed interface
+// only for tables created with a key_eq callback
+
+void *lfht_search_key(
+		struct lfht_head *head,
+		const void *key,
+		size_t len,
+		int thread_id);
+
+void lfht_insert_key(
+		struct lfht_head *head,
+		const void *key,
+		size_t len,
+		void *value,
+		int thread_id);
+
+void *lfht_put_key(
+		struct lfht_head *head,
+		const void *key,
+		size_t len,
+		void *value,
+		int thread_id);
+
+void *lfht_insert_if_absent_key(
+		struct lfht_head *head,
+		const void *key,
+		size_t len,
+		void *value,
+		int thread_id);
+
+void *lfht_compute_key(
+		struct lfht_head *head,
+		const void *key,
+		size_t len,
+		lfht_compute_fn fn,
+		void *ctx,
+		int thread_id);
+
+size_t lfht_fetch_add_key(
+		struct lfht_head *head,
+		const void *key,
+		size_t len,
+		size_t delta,
+		int thread_id);
+
+void lfht_remove_key(
+		struct lfht_head *head,
+		const void *key,
+		size_t len,
+		int thread_id);
+
+// byte string keys
+size_t lfht_hash_bytes(
+		const void *key,
+		size_t len);
+
+int lfht_eq_bytes(
+		const void *k1,
+		size_t len1,
+		const void *k2,
+		size_t len2);
+
 //debug interface
 
 void *lfht_debug_search(